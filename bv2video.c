@@ -1,25 +1,151 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#ifdef _WIN32
 #include <windows.h>
+#include <process.h>
+#include <io.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
 #include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/vfs.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <linux/fs.h>
+#endif
 #include "dirent.h" // ʹǰṩdirent.hʵ
 #include "cJSON.h"
 #include <libavformat/avformat.h>
 #include <libavutil/opt.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/cpu.h>
+#include <libavutil/threadmessage.h>
+#include <libavutil/fifo.h>
+#include <libavutil/hash.h>
 #include <libavcodec/avcodec.h>
+#include <libavutil/time.h>
 #include <locale.h>
+#include <time.h>
+#include <signal.h>
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#ifndef _WIN32
+// Windowsƽ̨²MSVCרк
+#define _strdup strdup
+#define strncpy_s(dst, size, src, count) snprintf((dst), (size), "%s", (src))
+#endif
+
+// ļ
+#ifdef _WIN32
+#define fd_open_read(path) _open((path), _O_RDONLY | _O_BINARY)
+#define fd_open_write(path) _open((path), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE)
+#define fd_read(fd, buf, size) _read((fd), (buf), (size))
+#define fd_write(fd, buf, size) _write((fd), (buf), (size))
+#define fd_seek(fd, offset, whence) _lseeki64((fd), (offset), (whence))
+#define fd_close(fd) _close(fd)
+#else
+#define fd_open_read(path) open((path), O_RDONLY)
+#define fd_open_write(path) open((path), O_WRONLY | O_CREAT | O_TRUNC, 0644)
+#define fd_read(fd, buf, size) read((fd), (buf), (size))
+#define fd_write(fd, buf, size) write((fd), (buf), (size))
+#define fd_seek(fd, offset, whence) lseek((fd), (offset), (whence))
+#define fd_close(fd) close(fd)
+#endif
+
+// ̷߳װWindowsʹ_beginthreadexƽ̨ʹpthread
+#ifdef _WIN32
+typedef HANDLE thread_t;
+#define THREAD_FUNC(name) unsigned __stdcall name(void* arg)
+static int thread_create(thread_t* thread, unsigned (__stdcall* func)(void*), void* arg) {
+    *thread = (HANDLE)_beginthreadex(NULL, 0, func, arg, 0, NULL);
+    return *thread ? 0 : -1;
+}
+static void thread_join(thread_t thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+#else
+typedef pthread_t thread_t;
+#define THREAD_FUNC(name) void* name(void* arg)
+static int thread_create(thread_t* thread, void* (*func)(void*), void* arg) {
+    return pthread_create(thread, NULL, func, arg);
+}
+static void thread_join(thread_t thread) {
+    pthread_join(thread, NULL);
+}
+#endif
+
+// װ
+#ifdef _WIN32
+typedef CRITICAL_SECTION mutex_t;
+#define mutex_init(m) InitializeCriticalSection(m)
+#define mutex_lock(m) EnterCriticalSection(m)
+#define mutex_unlock(m) LeaveCriticalSection(m)
+#define mutex_destroy(m) DeleteCriticalSection(m)
+typedef CONDITION_VARIABLE cond_t;
+#define cond_init(c) InitializeConditionVariable(c)
+#define cond_wait(c, m) SleepConditionVariableCS((c), (m), INFINITE)
+#define cond_broadcast(c) WakeAllConditionVariable(c)
+#define cond_destroy(c) ((void)(c))
+#else
+typedef pthread_mutex_t mutex_t;
+#define mutex_init(m) pthread_mutex_init((m), NULL)
+#define mutex_lock(m) pthread_mutex_lock(m)
+#define mutex_unlock(m) pthread_mutex_unlock(m)
+#define mutex_destroy(m) pthread_mutex_destroy(m)
+typedef pthread_cond_t cond_t;
+#define cond_init(c) pthread_cond_init((c), NULL)
+#define cond_wait(c, m) pthread_cond_wait((c), (m))
+#define cond_broadcast(c) pthread_cond_broadcast(c)
+#define cond_destroy(c) pthread_cond_destroy(c)
+#endif
+
+// ԭӼװֻͳƣҪڴʱ˳
+#ifdef _WIN32
+typedef volatile LONG64 atomic_counter_t;
+#define counter_add(c, v) InterlockedExchangeAdd64((c), (v))
+#define counter_load(c) InterlockedCompareExchange64((c), 0, 0)
+#define counter_store(c, v) InterlockedExchange64((c), (v))
+#else
+typedef int64_t atomic_counter_t;
+#define counter_add(c, v) __atomic_fetch_add((c), (v), __ATOMIC_RELAXED)
+#define counter_load(c) __atomic_load_n((c), __ATOMIC_RELAXED)
+#define counter_store(c, v) __atomic_store_n((c), (v), __ATOMIC_RELAXED)
+#endif
 
 // ļƳȺͳʼС
 #define MAX_NAME_LEN 256
 #define INITIAL_SIZE 10
 
+typedef struct PathPool PathPool;
+const char* internPath(PathPool* pool, const char* path);
+
 // ̬ṹ
 typedef struct {
     char** names;
     int size;
     int capacity;
+    PathPool* pool;     // ΪNULLʱƴ·У鲻
 } DynamicArray;
 // ʼ̬
 DynamicArray* createArray(int capacity) {
@@ -27,6 +153,14 @@ DynamicArray* createArray(int capacity) {
     array->names = (char**)malloc(capacity * sizeof(char*));
     array->size = 0;
     array->capacity = capacity;
+    array->pool = NULL;
+    return array;
+}
+
+// ʼƴ·еĶ̬
+DynamicArray* createPathArray(int capacity, PathPool* pool) {
+    DynamicArray* array = createArray(capacity);
+    array->pool = pool;
     return array;
 }
 
@@ -42,213 +176,5068 @@ void addName(DynamicArray* array, const char* name) {
         array->names = temp;
         array->capacity *= 2;
     }
-    array->names[array->size] = _strdup(name);
+    array->names[array->size] = array->pool ? (char*)internPath(array->pool, name) : _strdup(name);
     array->size++;
 }
 
 // ͷŶ̬
 void freeArray(DynamicArray* array) {
-    for (int i = 0; i < array->size; i++) {
+    for (int i = 0; i < array->size && array->pool == NULL; i++) {
         free(array->names[i]);
     }
     free(array->names);
     free(array);
 }
-// ȡļ
-char* read_file(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
-        printf("޷ļ %s\n", filename);
+
+// ַϣѰַϣڵǼѷļ
+typedef struct {
+    char** slots;
+    int size;
+    int capacity;
+} NameSet;
+
+static unsigned int hash_string(const char* str) {
+    unsigned int hash = 2166136261u;
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// ʼϣȡ2
+NameSet* createNameSet(int capacity) {
+    NameSet* set = (NameSet*)malloc(sizeof(NameSet));
+    int cap = 16;
+    while (cap < capacity * 2) {
+        cap *= 2;
+    }
+    set->slots = (char**)calloc(cap, sizeof(char*));
+    set->size = 0;
+    set->capacity = cap;
+    return set;
+}
+
+// ƣѴʱ0¼ʱ1
+int addNameToSet(NameSet* set, const char* name) {
+    if ((set->size + 1) * 2 > set->capacity) {
+        int cap = set->capacity * 2;
+        char** slots = (char**)calloc(cap, sizeof(char*));
+        if (slots == NULL) {
+            fprintf(stderr, "ڴʧ\n");
+            return 0;
+        }
+        for (int i = 0; i < set->capacity; i++) {
+            if (set->slots[i]) {
+                unsigned int j = hash_string(set->slots[i]) & (cap - 1);
+                while (slots[j]) {
+                    j = (j + 1) & (cap - 1);
+                }
+                slots[j] = set->slots[i];
+            }
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->capacity = cap;
+    }
+    unsigned int i = hash_string(name) & (set->capacity - 1);
+    while (set->slots[i]) {
+        if (strcmp(set->slots[i], name) == 0) {
+            return 0;
+        }
+        i = (i + 1) & (set->capacity - 1);
+    }
+    set->slots[i] = _strdup(name);
+    set->size++;
+    return 1;
+}
+
+// ͷż
+void freeNameSet(NameSet* set) {
+    for (int i = 0; i < set->capacity; i++) {
+        free(set->slots[i]);
+    }
+    free(set->slots);
+    free(set);
+}
+// ֲ߳̾
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+// ǰ̷߳δͷŵĶlibavĸʽġAVIOġݰԼjob_mallocķ䡣
+// ʱ뿪ʼʱ˵й©˶
+static THREAD_LOCAL int64_t thread_live_objects;
+
+static void mem_acquire(const void* ptr) {
+    if (ptr) {
+        thread_live_objects++;
+    }
+}
+
+static void mem_release(const void* ptr) {
+    if (ptr) {
+        thread_live_objects--;
+    }
+}
+
+// ׷ʽڴأarenaӴڴ˳䣬ܵͷţ
+// һһáڽ׶εentry.jsonݺcJSONڵ
+#define ARENA_CHUNK_SIZE (64 << 10)
+#define ARENA_ALIGN 16
+
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t size;
+    size_t used;
+    uint8_t* data;
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk* head;   // ǰĿ飬nextָĿ
+} Arena;
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    ArenaChunk* chunk = arena->head;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        size_t chunk_size = FFMAX(size, ARENA_CHUNK_SIZE);
+        // ͷҲARENA_ALIGN룬ݽڿͷ֮
+        size_t header = (sizeof(ArenaChunk) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+        chunk = (ArenaChunk*)malloc(header + chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->data = (uint8_t*)chunk + header;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->next = arena->head;
+        arena->head = chunk;
+    }
+    void* ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+char* arena_strdup(Arena* arena, const char* str) {
+    size_t len = strlen(str) + 1;
+    char* copy = (char*)arena_alloc(arena, len);
+    if (copy) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+// ָǷarena
+int arena_owns(const Arena* arena, const void* ptr) {
+    for (const ArenaChunk* chunk = arena->head; chunk; chunk = chunk->next) {
+        if ((const uint8_t*)ptr >= chunk->data && (const uint8_t*)ptr < chunk->data + chunk->size) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// ͷз䣬һ׼СĿ鹩һʹ
+void arena_reset(Arena* arena) {
+    ArenaChunk* keep = NULL;
+    while (arena->head) {
+        ArenaChunk* chunk = arena->head;
+        arena->head = chunk->next;
+        if (keep == NULL && chunk->size == ARENA_CHUNK_SIZE) {
+            keep = chunk;
+        }
+        else {
+            free(chunk);
+        }
+    }
+    if (keep) {
+        keep->used = 0;
+        keep->next = NULL;
+        arena->head = keep;
+    }
+}
+
+void arena_free(Arena* arena) {
+    while (arena->head) {
+        ArenaChunk* chunk = arena->head;
+        arena->head = chunk->next;
+        free(chunk);
+    }
+}
+
+// ǰ̵߳ڴأΪNULLʱֱʹmalloc/free
+static THREAD_LOCAL Arena* thread_arena;
+
+void setThreadArena(Arena* arena) {
+    thread_arena = arena;
+}
+
+// ڵʱ䣺ǰ߳ڴʱڴط
+static void* job_malloc(size_t size) {
+    void* ptr = thread_arena ? arena_alloc(thread_arena, size) : malloc(size);
+    mem_acquire(ptr);
+    return ptr;
+}
+
+// ڴеķʱͳһͷţֻͷmallocõڴ
+static void job_free(void* ptr) {
+    mem_release(ptr);
+    if (ptr && (thread_arena == NULL || !arena_owns(thread_arena, ptr))) {
+        free(ptr);
+    }
+}
+
+// ·أɨõĿ¼·ֻ׷ӵĴڴУͬ·ֻһݣ
+// ֱǰͷšֻһ߳м룬ַ߳жȡ
+struct PathPool {
+    Arena arena;
+    const char** slots;
+    int size;
+    int capacity;
+};
+
+PathPool* createPathPool(void) {
+    PathPool* pool = (PathPool*)calloc(1, sizeof(PathPool));
+    if (pool == NULL) {
         return NULL;
     }
-    fseek(file, 0, SEEK_END);
-    long length = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    char* data = (char*)malloc(length + 1);
-    if (data == NULL) {
-        fclose(file);
-        printf("ڴʧ\n");
+    pool->capacity = 1024;
+    pool->slots = (const char**)calloc(pool->capacity, sizeof(const char*));
+    if (pool->slots == NULL) {
+        free(pool);
         return NULL;
     }
-    fread(data, 1, length, file);
-    data[length] = '\0';
-    fclose(file);
-    return data;
+    return pool;
 }
-double get_frame_rate(const char* video_file) {
-    AVFormatContext* format_ctx = NULL;
-    AVStream* video_stream = NULL;
-    double frame_rate = 0.0;
 
-    if (avformat_open_input(&format_ctx, video_file, NULL, NULL) != 0) {
-        fprintf(stderr, "޷Ƶļ\n");
-        return 0.0;
+// ·ڳеĸڴ治ʱNULL
+const char* internPath(PathPool* pool, const char* path) {
+    if ((pool->size + 1) * 2 > pool->capacity) {
+        int cap = pool->capacity * 2;
+        const char** slots = (const char**)calloc(cap, sizeof(const char*));
+        if (slots == NULL) {
+            return NULL;
+        }
+        for (int i = 0; i < pool->capacity; i++) {
+            if (pool->slots[i]) {
+                unsigned int j = hash_string(pool->slots[i]) & (cap - 1);
+                while (slots[j]) {
+                    j = (j + 1) & (cap - 1);
+                }
+                slots[j] = pool->slots[i];
+            }
+        }
+        free(pool->slots);
+        pool->slots = slots;
+        pool->capacity = cap;
+    }
+    unsigned int i = hash_string(path) & (pool->capacity - 1);
+    while (pool->slots[i]) {
+        if (strcmp(pool->slots[i], path) == 0) {
+            return pool->slots[i];
+        }
+        i = (i + 1) & (pool->capacity - 1);
+    }
+    const char* copy = arena_strdup(&pool->arena, path);
+    if (copy) {
+        pool->slots[i] = copy;
+        pool->size++;
+    }
+    return copy;
+}
+
+void freePathPool(PathPool* pool) {
+    arena_free(&pool->arena);
+    free(pool->slots);
+    free(pool);
+}
+
+// ---------------- ʱ ----------------
+// Chrome traceʽchrome://tracingPerfettoԴ򿪣ʱߣÿ߳һ
+// ÿ̰߳¼¼ԼĻУֻڴʱ¼¼߳̾
+
+typedef struct {
+    const char* category;   // ַ̬
+    const char* name;       // ַ̬
+    const char* label;      // ¼˵缯Ŀ¼ļȣڻڴУΪNULL
+    int64_t ts;
+    int64_t value;          // 'X'Ϊʱ䣬'C'Ϊֵ
+    char phase;             // 'X'ʱΣ'C'
+} TraceEvent;
+
+typedef struct TraceBuffer {
+    struct TraceBuffer* next;
+    char name[32];
+    int tid;
+    TraceEvent* events;
+    int nb_events;
+    int capacity;
+    Arena labels;
+} TraceBuffer;
+
+typedef struct {
+    mutex_t lock;
+    TraceBuffer* buffers;
+    int nb_buffers;
+    int64_t start;
+} Tracer;
+
+// ΪNULLʱ¼ʱ
+static Tracer* tracer;
+static THREAD_LOCAL TraceBuffer* thread_trace;
+
+int startTrace(void) {
+    tracer = (Tracer*)calloc(1, sizeof(Tracer));
+    if (tracer == NULL) {
+        return -1;
     }
+    mutex_init(&tracer->lock);
+    tracer->start = av_gettime_relative();
+    return 0;
+}
 
-    if (avformat_find_stream_info(format_ctx, NULL) < 0) {
-        fprintf(stderr, "޷ȡƵļϢ\n");
-        avformat_close_input(&format_ctx);
-        return 0.0;
+// Ϊǰ̴߳һname
+void beginThreadTrace(const char* name) {
+    if (tracer == NULL) {
+        return;
+    }
+    TraceBuffer* buffer = (TraceBuffer*)calloc(1, sizeof(TraceBuffer));
+    if (buffer == NULL) {
+        return;
     }
+    mutex_lock(&tracer->lock);
+    buffer->tid = ++tracer->nb_buffers;
+    buffer->next = tracer->buffers;
+    tracer->buffers = buffer;
+    mutex_unlock(&tracer->lock);
+    snprintf(buffer->name, sizeof(buffer->name), "%s %d", name, buffer->tid);
+    thread_trace = buffer;
+}
 
-    for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
-        if (format_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-            video_stream = format_ctx->streams[i];
-            break;
+static TraceEvent* trace_add(char phase, const char* category, const char* name, int64_t ts, int64_t value) {
+    TraceBuffer* buffer = thread_trace;
+    if (buffer->nb_events == buffer->capacity) {
+        int capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        TraceEvent* tmp = (TraceEvent*)realloc(buffer->events, capacity * sizeof(TraceEvent));
+        if (tmp == NULL) {
+            return NULL;
         }
+        buffer->events = tmp;
+        buffer->capacity = capacity;
     }
+    TraceEvent* event = &buffer->events[buffer->nb_events++];
+    event->phase = phase;
+    event->category = category;
+    event->name = name;
+    event->label = NULL;
+    event->ts = ts;
+    event->value = value;
+    return event;
+}
 
-    if (video_stream) {
-        AVRational frame_rate_rational = av_guess_frame_rate(format_ctx, video_stream, NULL);
-        frame_rate = av_q2d(frame_rate_rational);
+// ¼һʱΣstartendΪav_gettime_relative()ֵ
+void traceSpan(const char* category, const char* name, const char* label, int64_t start, int64_t end) {
+    if (thread_trace) {
+        TraceEvent* event = trace_add('X', category, name, start, end - start);
+        if (event && label) {
+            event->label = arena_strdup(&thread_trace->labels, label);
+        }
     }
+}
 
-    avformat_close_input(&format_ctx);
-    return frame_rate;
+// ¼еϢ
+static void trace_queue_depth(const char* name, AVThreadMessageQueue* queue) {
+    if (thread_trace) {
+        trace_add('C', "queue", name, av_gettime_relative(), av_thread_message_queue_nb_elems(queue));
+    }
 }
 
-int merge_audio_video(const char* audio_file, const char* video_file, const char* output_file) {
-    AVFormatContext* input_format_ctx_audio = NULL, * input_format_ctx_video = NULL, * output_format_ctx = NULL;
-    AVOutputFormat* output_format = NULL;
-    AVStream* audio_stream = NULL, * video_stream = NULL, * out_audio_stream = NULL, * out_video_stream = NULL;
-    AVPacket packet;
-    int ret;
-    double frame_rate;
+// дJSONַתšбܺͿַ
+static void json_print_string(FILE* file, const char* str) {
+    fputc('"', file);
+    for (const unsigned char* p = (const unsigned char*)str; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(file, "\\%c", *p);
+        }
+        else if (*p < 0x20) {
+            fprintf(file, "\\u%04x", *p);
+        }
+        else {
+            fputc(*p, file);
+        }
+    }
+    fputc('"', file);
+}
 
-    // ȡƵ֡
-    frame_rate = get_frame_rate(video_file);
-    if (frame_rate == 0.0) {
-        fprintf(stderr, "޷ȡƵ֡ʡ\n");
+// дʱ߲ͷлм¼ʱߵ̶߳Ӧѽ
+int finishTrace(const char* path) {
+    int ret = -1;
+    if (tracer == NULL) {
         return -1;
     }
+    FILE* file = fopen(path, "w");
+    if (file) {
+        fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"bv2video\"}}");
+        for (TraceBuffer* buffer = tracer->buffers; buffer; buffer = buffer->next) {
+            fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ",
+                    buffer->tid);
+            json_print_string(file, buffer->name);
+            fprintf(file, "}}");
+            for (int i = 0; i < buffer->nb_events; i++) {
+                const TraceEvent* event = &buffer->events[i];
+                long long ts = event->ts - tracer->start;
+                if (event->phase == 'C') {
+                    fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"C\", \"pid\": 1, \"ts\": %lld, "
+                            "\"args\": {\"depth\": %lld}}", event->name, event->category, ts, (long long)event->value);
+                    continue;
+                }
+                fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %lld, "
+                        "\"dur\": %lld", event->name, event->category, buffer->tid, ts, (long long)event->value);
+                if (event->label) {
+                    fprintf(file, ", \"args\": {\"item\": ");
+                    json_print_string(file, event->label);
+                    fprintf(file, "}");
+                }
+                fprintf(file, "}");
+            }
+        }
+        fprintf(file, "\n]}\n");
+        ret = fclose(file) == 0 ? 0 : -1;
+    }
+    while (tracer->buffers) {
+        TraceBuffer* buffer = tracer->buffers;
+        tracer->buffers = buffer->next;
+        free(buffer->events);
+        arena_free(&buffer->labels);
+        free(buffer);
+    }
+    mutex_destroy(&tracer->lock);
+    free(tracer);
+    tracer = NULL;
+    thread_trace = NULL;
+    return ret;
+}
 
-    // ļ
-    if ((ret = avformat_open_input(&input_format_ctx_audio, audio_file, 0, 0)) < 0) {
-        fprintf(stderr, "޷Ƶļ\n");
-        return ret;
+// ---------------- ͳ ----------------
+// õʱӲ׶εʱ뵱ǰ߳ڴ񣬼¼ʱʱͬʱΪʱΣ
+// ߶Ҫʱʱֻһж
+enum {
+    STAGE_OPEN_INPUT,       // avformat_open_inputΪ򿪲ĺ
+    STAGE_FIND_STREAM_INFO,
+    STAGE_WRITE_HEADER,     // avformat_write_headerԤmoovС
+    STAGE_COPY,             // дѭΪдmoovͷƬ
+    STAGE_TRAILER,          // av_write_trailer͹رļ
+    NB_STAGES
+};
+
+static const char* const stage_names[NB_STAGES] = {
+    "open_input", "find_stream_info", "write_header", "copy", "trailer",
+};
+
+// ʱи׶
+static const char* const stage_categories[NB_STAGES] = {
+    "probe", "probe", "remux", "remux", "trailer",
+};
+
+// һͳƣʱ䵥λΪ΢
+typedef struct {
+    int64_t time[NB_STAGES];
+    int64_t bytes_in;
+    int64_t bytes_out;
+    int64_t packets;
+    int64_t queue_packets;  // ֯ݰֵ㣩
+    int64_t queue_bytes;    // ֵ֯㣩
+    int64_t rss_kb;         // ʱ̵ĳפڴ棬ȡʱΪ-1
+    int64_t peak_rss_kb;    // ʱ̳פڴķֵ̹߳
+    int64_t heap_bytes;     // ʱѷڴ棬ȡʱΪ-1
+    int64_t leaked;         // δͷŵĶ
+} StageStats;
+
+static THREAD_LOCAL StageStats* thread_stats;
+
+void setThreadStats(StageStats* stats) {
+    thread_stats = stats;
+}
+
+// ̵ǰͷֵĳפڴ棨KBȡʱΪ-1
+static void get_process_memory(int64_t* rss_kb, int64_t* peak_kb) {
+    *rss_kb = *peak_kb = -1;
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        *rss_kb = pmc.WorkingSetSize / 1024;
+        *peak_kb = pmc.PeakWorkingSetSize / 1024;
     }
-    if ((ret = avformat_open_input(&input_format_ctx_video, video_file, 0, 0)) < 0) {
-        fprintf(stderr, "޷Ƶļ\n");
-        return ret;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        *peak_kb = usage.ru_maxrss / 1024;
+#else
+        *peak_kb = usage.ru_maxrss;
+#endif
     }
-    if ((ret = avformat_find_stream_info(input_format_ctx_audio, 0)) < 0) {
-        fprintf(stderr, "޷ȡƵļϢ\n");
-        return ret;
+#ifdef __linux__
+    long size, pages;
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file) {
+        if (fscanf(file, "%ld %ld", &size, &pages) == 2) {
+            *rss_kb = pages * (sysconf(_SC_PAGESIZE) / 1024);
+        }
+        fclose(file);
     }
-    if ((ret = avformat_find_stream_info(input_format_ctx_video, 0)) < 0) {
-        fprintf(stderr, "޷ȡƵļϢ\n");
-        return ret;
+#endif
+#endif
+}
+
+// ѷڴ棨ֽڣ֧ʱΪ-1
+static int64_t get_heap_bytes(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+    return (int64_t)(info.uordblks + info.hblkhd);
+#else
+    return -1;
+#endif
+}
+
+static int64_t stage_begin(void) {
+    return thread_stats || thread_trace ? av_gettime_relative() : 0;
+}
+
+static void stage_end(int stage, int64_t start) {
+    if (thread_stats || thread_trace) {
+        int64_t end = av_gettime_relative();
+        if (thread_stats) {
+            thread_stats->time[stage] += end - start;
+        }
+        traceSpan(stage_categories[stage], stage_names[stage], NULL, start, end);
     }
-    avformat_alloc_output_context2(&output_format_ctx, NULL, NULL, output_file);
-    if (!output_format_ctx) {
-        fprintf(stderr, "޷ġ\n");
-        return AVERROR_UNKNOWN;
+}
+
+typedef struct {
+    char* output;
+    int failed;
+    StageStats stats;
+} JobRecord;
+
+// һеͳƣ¼ɸ̼߳׷ӣʱֻڽ߳׷
+typedef struct {
+    mutex_t lock;
+    JobRecord* jobs;
+    int nb_jobs;
+    int jobs_capacity;
+    int64_t* parse_times;
+    int nb_parse;
+    int parse_capacity;
+    int64_t scan_time;
+    int64_t start;
+    int parse_leaks;        // зδͷŵľ缯
+} RunStats;
+
+RunStats* createRunStats(void) {
+    RunStats* stats = (RunStats*)calloc(1, sizeof(RunStats));
+    if (stats) {
+        mutex_init(&stats->lock);
+        stats->start = av_gettime_relative();
     }
-    output_format = output_format_ctx->oformat;
+    return stats;
+}
 
-    // Ƶ
-    audio_stream = input_format_ctx_audio->streams[0];
-    out_audio_stream = avformat_new_stream(output_format_ctx, NULL);
-    if (!out_audio_stream) {
-        fprintf(stderr, "޷Ƶ\n");
-        return AVERROR_UNKNOWN;
+void recordParseTime(RunStats* stats, int64_t time) {
+    if (stats->nb_parse == stats->parse_capacity) {
+        int capacity = stats->parse_capacity ? stats->parse_capacity * 2 : 1024;
+        int64_t* tmp = (int64_t*)realloc(stats->parse_times, capacity * sizeof(int64_t));
+        if (tmp == NULL) {
+            return;
+        }
+        stats->parse_times = tmp;
+        stats->parse_capacity = capacity;
     }
-    if ((ret = avcodec_parameters_copy(out_audio_stream->codecpar, audio_stream->codecpar)) < 0) {
-        fprintf(stderr, "޷Ƶ\n");
-        return ret;
+    stats->parse_times[stats->nb_parse++] = time;
+}
+
+void recordJobStats(RunStats* stats, const char* output, int failed, const StageStats* job) {
+    mutex_lock(&stats->lock);
+    if (stats->nb_jobs == stats->jobs_capacity) {
+        int capacity = stats->jobs_capacity ? stats->jobs_capacity * 2 : 64;
+        JobRecord* tmp = (JobRecord*)realloc(stats->jobs, capacity * sizeof(JobRecord));
+        if (tmp) {
+            stats->jobs = tmp;
+            stats->jobs_capacity = capacity;
+        }
     }
-    out_audio_stream->time_base = audio_stream->time_base;
+    if (stats->nb_jobs < stats->jobs_capacity) {
+        JobRecord* record = &stats->jobs[stats->nb_jobs++];
+        record->output = _strdup(output);
+        record->failed = failed;
+        record->stats = *job;
+    }
+    mutex_unlock(&stats->lock);
+}
 
-    // Ƶ
-    video_stream = input_format_ctx_video->streams[0];
-    out_video_stream = avformat_new_stream(output_format_ctx, NULL);
-    if (!out_video_stream) {
-        fprintf(stderr, "޷Ƶ\n");
-        return AVERROR_UNKNOWN;
+void freeRunStats(RunStats* stats) {
+    for (int i = 0; i < stats->nb_jobs; i++) {
+        free(stats->jobs[i].output);
     }
-    if ((ret = avcodec_parameters_copy(out_video_stream->codecpar, video_stream->codecpar)) < 0) {
-        fprintf(stderr, "޷Ƶ\n");
-        return ret;
+    free(stats->jobs);
+    free(stats->parse_times);
+    mutex_destroy(&stats->lock);
+    free(stats);
+}
+
+static int compare_int64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// дһʱĺϼƺͷλvaluesᱻ
+static void write_stage_json(FILE* file, const char* name, int64_t* values, int count) {
+    int64_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += values[i];
     }
-    out_video_stream->time_base = (AVRational){ 1, (int)frame_rate };
-    out_video_stream->codecpar->codec_tag = 0;
+    qsort(values, count, sizeof(int64_t), compare_int64);
+#define PERCENTILE_MS(p) (count ? values[(int)((int64_t)(count - 1) * (p) / 100)] / 1e3 : 0)
+    fprintf(file, "    \"%s\": {\"count\": %d, \"total_s\": %.6f, \"mean_ms\": %.3f, \"p50_ms\": %.3f, "
+            "\"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f}",
+            name, count, total / 1e6, count ? total / 1e3 / count : 0,
+            PERCENTILE_MS(50), PERCENTILE_MS(90), PERCENTILE_MS(99), PERCENTILE_MS(100));
+#undef PERCENTILE_MS
+}
 
-    // ļ
-    if (!(output_format->flags & AVFMT_NOFILE)) {
-        if ((ret = avio_open(&output_format_ctx->pb, output_file, AVIO_FLAG_WRITE)) < 0) {
-            fprintf(stderr, "޷ļ\n");
-            return ret;
+// дJSONʽб棺׶εĺϼƺͷλֽÿ봦İԼÿϸ
+int writeRunReport(RunStats* stats, const char* path, int nb_workers, int skipped) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    int64_t wall = av_gettime_relative() - stats->start;
+    int64_t bytes_in = 0, bytes_out = 0, packets = 0, copy_time = 0;
+    int failed = 0;
+    for (int i = 0; i < stats->nb_jobs; i++) {
+        bytes_in += stats->jobs[i].stats.bytes_in;
+        bytes_out += stats->jobs[i].stats.bytes_out;
+        packets += stats->jobs[i].stats.packets;
+        copy_time += stats->jobs[i].stats.time[STAGE_COPY];
+        failed += stats->jobs[i].failed;
+    }
+    fprintf(file, "{\n  \"wall_s\": %.6f,\n  \"workers\": %d,\n  \"episodes\": %d,\n  \"jobs\": %d,\n"
+            "  \"failed\": %d,\n  \"skipped\": %d,\n",
+            wall / 1e6, nb_workers, stats->nb_parse, stats->nb_jobs, failed, skipped);
+    fprintf(file, "  \"bytes_in\": %lld,\n  \"bytes_out\": %lld,\n  \"mb_per_s\": %.3f,\n  \"packets\": %lld,\n"
+            "  \"packets_per_s\": %.1f,\n  \"copy_packets_per_s\": %.1f,\n",
+            (long long)bytes_in, (long long)bytes_out, wall > 0 ? bytes_in / (double)wall : 0, (long long)packets,
+            wall > 0 ? packets * 1e6 / wall : 0, copy_time > 0 ? packets * 1e6 / copy_time : 0);
+
+    // ڴ棺˳¼һһʱѵĲֵӳĻй©
+    int64_t peak_rss_kb = -1, queue_packets = 0, queue_bytes = 0, leaked = 0, rss_kb, peak_kb;
+    int leaking_jobs = 0;
+    for (int i = 0; i < stats->nb_jobs; i++) {
+        const StageStats* job = &stats->jobs[i].stats;
+        peak_rss_kb = FFMAX(peak_rss_kb, job->peak_rss_kb);
+        queue_packets = FFMAX(queue_packets, job->queue_packets);
+        queue_bytes = FFMAX(queue_bytes, job->queue_bytes);
+        leaked += job->leaked;
+        leaking_jobs += job->leaked != 0;
+    }
+    get_process_memory(&rss_kb, &peak_kb);
+    int64_t heap_first = stats->nb_jobs ? stats->jobs[0].stats.heap_bytes : -1;
+    int64_t heap_last = stats->nb_jobs ? stats->jobs[stats->nb_jobs - 1].stats.heap_bytes : -1;
+    fprintf(file, "  \"memory\": {\"peak_rss_kb\": %lld, \"final_rss_kb\": %lld, \"max_queue_packets\": %lld, "
+            "\"max_queue_bytes\": %lld, \"heap_first_job\": %lld, \"heap_last_job\": %lld, \"heap_growth_per_job\": %.1f, "
+            "\"leaking_jobs\": %d, \"leaked_objects\": %lld, \"leaking_parses\": %d},\n",
+            (long long)FFMAX(peak_rss_kb, peak_kb), (long long)rss_kb, (long long)queue_packets, (long long)queue_bytes,
+            (long long)heap_first, (long long)heap_last,
+            stats->nb_jobs > 1 && heap_first >= 0 ? (heap_last - heap_first) / (double)(stats->nb_jobs - 1) : 0,
+            leaking_jobs, (long long)leaked, stats->parse_leaks);
+
+    // ɨֻһ߳Уֻкϼ
+    fprintf(file, "  \"stages\": {\n    \"scan\": {\"count\": 1, \"total_s\": %.6f},\n", stats->scan_time / 1e6);
+    write_stage_json(file, "parse", stats->parse_times, stats->nb_parse);
+    int64_t* values = (int64_t*)malloc(FFMAX(stats->nb_jobs, 1) * sizeof(int64_t));
+    for (int s = 0; s < NB_STAGES && values; s++) {
+        for (int i = 0; i < stats->nb_jobs; i++) {
+            values[i] = stats->jobs[i].stats.time[s];
         }
+        fprintf(file, ",\n");
+        write_stage_json(file, stage_names[s], values, stats->nb_jobs);
     }
+    free(values);
 
-    if ((ret = avformat_write_header(output_format_ctx, NULL)) < 0) {
-        fprintf(stderr, "ļʱ\n");
-        return ret;
+    fprintf(file, "\n  },\n  \"job_details\": [");
+    for (int i = 0; i < stats->nb_jobs; i++) {
+        const JobRecord* job = &stats->jobs[i];
+        fprintf(file, "%s\n    {\"output\": ", i ? "," : "");
+        json_print_string(file, job->output);
+        fprintf(file, ", \"failed\": %s", job->failed ? "true" : "false");
+        for (int s = 0; s < NB_STAGES; s++) {
+            fprintf(file, ", \"%s_ms\": %.3f", stage_names[s], job->stats.time[s] / 1e3);
+        }
+        fprintf(file, ", \"bytes_in\": %lld, \"bytes_out\": %lld, \"packets\": %lld, \"queue_packets\": %lld, "
+                "\"queue_bytes\": %lld, \"rss_kb\": %lld, \"peak_rss_kb\": %lld, \"heap_bytes\": %lld, \"leaked_objects\": %lld}",
+                (long long)job->stats.bytes_in, (long long)job->stats.bytes_out, (long long)job->stats.packets,
+                (long long)job->stats.queue_packets, (long long)job->stats.queue_bytes, (long long)job->stats.rss_kb,
+                (long long)job->stats.peak_rss_kb, (long long)job->stats.heap_bytes, (long long)job->stats.leaked);
     }
+    fprintf(file, "\n  ]\n}\n");
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+// ---------------- нȺָ ----------------
+// дֽ͸׶ʱֱͼԭӼۼƣÿ̵߳ļ
+// ԼĲλУ̶̰߳ȡϲλڱ׼ȣ
+// ָ߰Prometheusıʽдļ
+
+// ʱֱͼHDR񣩣ÿ2ٵȷΪ4Ͱ25%λΪ΢룬
+// һͰֵֻ֮
+#define HIST_SUB_BITS 2
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define NB_HIST_BUCKETS (32 * HIST_SUB_BUCKETS)
+// дָʱͰʼԼ1룩СֵϲһͰ
+#define HIST_EXPORT_FIRST (9 * HIST_SUB_BUCKETS - 1)
+
+typedef struct {
+    atomic_counter_t buckets[NB_HIST_BUCKETS];
+    atomic_counter_t count;
+    atomic_counter_t sum;
+} Histogram;
+
+enum {
+    METRIC_PROBE,
+    METRIC_REMUX,
+    METRIC_TRAILER,
+    METRIC_JOB,
+    NB_METRICS
+};
+
+static const char* const metric_names[NB_METRICS] = {
+    "probe", "remux", "trailer", "job",
+};
 
-    // дƵݰ
-    while (av_read_frame(input_format_ctx_audio, &packet) >= 0) {
-        packet.stream_index = out_audio_stream->index;
-        av_packet_rescale_ts(&packet, audio_stream->time_base, out_audio_stream->time_base);
-        av_interleaved_write_frame(output_format_ctx, &packet);
-        av_packet_unref(&packet);
+// һ̵߳ļֻɸ߳д롣ĩβһУڲλļͬһ
+typedef struct {
+    atomic_counter_t bytes_read;    // ۼƶȡֽ
+    atomic_counter_t bytes_written; // ۼдֽ
+    atomic_counter_t job_base;      // ǰʼʱbytes_read
+    int64_t job_start;              // ǰʼʱ䣬ֻڹ߳ʹ
+    Histogram latency[NB_METRICS];
+    char padding[64];
+} ProgressSlot;
+
+// ̶߳ȡϢ
+enum {
+    PROGRESS_QUEUE_DIR,
+    PROGRESS_QUEUE_JOB,
+    NB_PROGRESS_QUEUES
+};
+
+static const char* const progress_queue_names[NB_PROGRESS_QUEUES] = {
+    "dir", "job",
+};
+
+typedef struct {
+    ProgressSlot* slots;
+    int nb_slots;
+    int64_t interval;               // ȵļ΢룩Ϊ0ʱ
+    const char* metrics_path;       // ΪNULLʱдָļ
+    atomic_counter_t nb_total;      // ύ
+    atomic_counter_t nb_done;
+    atomic_counter_t nb_failed;
+    atomic_counter_t total_bytes;   // ύֽ
+    atomic_counter_t done_bytes;    // ѽֽ
+    atomic_counter_t scanning;      // ɨδ
+    atomic_counter_t stop;
+    thread_t thread;
+    mutex_t queue_lock;             // queuesͷǰҪȴƳ
+    AVThreadMessageQueue* queues[NB_PROGRESS_QUEUES];
+    // ֻڲ߳ʹ
+    int64_t* last_read;
+    int64_t last_time;
+    int64_t last_written;
+    int64_t last_processed;
+    int64_t last_metrics;
+    double rate;                    // ٶȵָƽֽ/룩ڹʣʱ
+} Progress;
+
+// ̼߳Ƿ˳ļ΢룩
+#define PROGRESS_POLL_INTERVAL 100000
+// дָļļ΢룩
+#define METRICS_INTERVAL (5 * AV_TIME_BASE)
+
+// ΪNULLʱͳƽ
+static Progress* progress;
+static THREAD_LOCAL ProgressSlot* thread_progress;
+
+// ָҪ׶εʱ߳̾ݴ˾Ƿͳ
+static int metrics_enabled(void) {
+    return progress && progress->metrics_path;
+}
+
+// Ͱindex(histogram_bound(index - 1), histogram_bound(index)]ڵֵPrometheusleһ
+static int histogram_index(int64_t value) {
+    // value-1ͰǡõϽֵͰ
+    value--;
+    if (value < HIST_SUB_BUCKETS) {
+        return value < 0 ? 0 : (int)value;
+    }
+    int msb = 63;
+    while (!(value >> msb)) {
+        msb--;
+    }
+    int index = (msb - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + (int)((value >> (msb - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+    return FFMIN(index, NB_HIST_BUCKETS);
+}
+
+// ͰϽ磨
+static int64_t histogram_bound(int index) {
+    int octave = index / HIST_SUB_BUCKETS;
+    if (octave == 0) {
+        return index + 1;
+    }
+    return (int64_t)(HIST_SUB_BUCKETS + index % HIST_SUB_BUCKETS + 1) << (octave - 1);
+}
+
+static void histogram_add(Histogram* hist, int64_t value) {
+    int index = histogram_index(value);
+    if (index < NB_HIST_BUCKETS) {
+        counter_add(&hist->buckets[index], 1);
+    }
+    counter_add(&hist->count, 1);
+    counter_add(&hist->sum, value);
+}
+
+static void progress_read(int64_t size) {
+    if (thread_progress) {
+        counter_add(&thread_progress->bytes_read, size);
+    }
+}
+
+static void progress_write(int64_t size) {
+    if (thread_progress) {
+        counter_add(&thread_progress->bytes_written, size);
+    }
+}
+
+// ߳ʱȡԼĲλ
+static void setThreadProgress(int worker) {
+    thread_progress = progress && worker < progress->nb_slots ? &progress->slots[worker] : NULL;
+}
+
+// ߳̿ʼһ
+static void progress_begin_job(void) {
+    if (thread_progress) {
+        counter_store(&thread_progress->job_base, counter_load(&thread_progress->bytes_read));
+        thread_progress->job_start = av_gettime_relative();
+    }
+}
+
+// ߳̽һsizeΪֽstatsΪ׶εʱͳʱΪNULL
+static void progress_end_job(int64_t size, int failed, const StageStats* stats) {
+    if (progress == NULL) {
+        return;
+    }
+    if (thread_progress) {
+        counter_store(&thread_progress->job_base, counter_load(&thread_progress->bytes_read));
+        histogram_add(&thread_progress->latency[METRIC_JOB], av_gettime_relative() - thread_progress->job_start);
+        if (stats) {
+            int64_t times[3] = {
+                stats->time[STAGE_OPEN_INPUT] + stats->time[STAGE_FIND_STREAM_INFO],
+                stats->time[STAGE_WRITE_HEADER] + stats->time[STAGE_COPY],
+                stats->time[STAGE_TRAILER],
+            };
+            // ûоĽ׶Σȥʱֱӣ
+            for (int i = 0; i < 3; i++) {
+                if (times[i] > 0) {
+                    histogram_add(&thread_progress->latency[i], times[i]);
+                }
+            }
+        }
+    }
+    counter_add(&progress->done_bytes, size);
+    counter_add(failed ? &progress->nb_failed : &progress->nb_done, 1);
+}
+
+// ǼύsizeΪֽύʧʱԸ
+void progressAddJob(int nb_jobs, int64_t size) {
+    if (progress) {
+        counter_add(&progress->nb_total, nb_jobs);
+        counter_add(&progress->total_bytes, size);
+    }
+}
+
+// ɨ˺ӣģʽ⣩
+void endProgressScan(void) {
+    if (progress) {
+        counter_store(&progress->scanning, 0);
+    }
+}
+
+// ǼǻƳqueueΪNULL̶߳ȡȵĶУͷǰƳ
+void setProgressQueue(int which, AVThreadMessageQueue* queue) {
+    if (progress) {
+        mutex_lock(&progress->queue_lock);
+        progress->queues[which] = queue;
+        mutex_unlock(&progress->queue_lock);
+    }
+}
+
+static void format_duration(char* buf, size_t size, double seconds) {
+    int64_t s = (int64_t)seconds;
+    snprintf(buf, size, "%lld:%02d:%02d", (long long)(s / 3600), (int)(s / 60 % 60), (int)(s % 60));
+}
+
+// һνȣelapsedΪϴʱ䣨΢룩
+static void progress_sample(Progress* p, int64_t elapsed) {
+    int64_t read = 0, written = 0, processed = counter_load(&p->done_bytes);
+    double seconds = elapsed / 1e6;
+    char eta[32] = "--:--:--";
+    char workers[1024];
+    int len = 0;
+
+    workers[0] = '\0';
+    for (int i = 0; i < p->nb_slots; i++) {
+        int64_t r = counter_load(&p->slots[i].bytes_read);
+        // ڴѶȡĲҲѴ
+        processed += FFMAX(r - counter_load(&p->slots[i].job_base), 0);
+        if (len < (int)sizeof(workers)) {
+            len += snprintf(workers + len, sizeof(workers) - len, " %.1f", (r - p->last_read[i]) / seconds / 1e6);
+        }
+        read += r - p->last_read[i];
+        written += counter_load(&p->slots[i].bytes_written);
+        p->last_read[i] = r;
+    }
+
+    double rate = (processed - p->last_processed) / seconds;
+    p->rate = p->rate > 0 ? 0.7 * p->rate + 0.3 * rate : rate;
+    int64_t total = counter_load(&p->total_bytes);
+    if (p->rate > 0 && total >= processed) {
+        format_duration(eta, sizeof(eta), (total - processed) / p->rate);
+    }
+    int scanning = counter_load(&p->scanning) != 0;
+    fprintf(stderr, ": 缯 %lld/%lld%sʧ %lldѴ %.1f/%.1f MB %.1f MB/sд %.1f MB/sԤʣ %s%s\n",
+            (long long)counter_load(&p->nb_done), (long long)counter_load(&p->nb_total), scanning ? "+" : "",
+            (long long)counter_load(&p->nb_failed), processed / 1e6, total / 1e6, read / seconds / 1e6,
+            (written - p->last_written) / seconds / 1e6, eta, scanning ? "ɨ裩" : "");
+    fprintf(stderr, "̶߳ȡ MB/s:%s\n", workers);
+    p->last_processed = processed;
+    p->last_written = written;
+}
+
+// ϲ̵ֱ߳ͼPrometheusۻͰʽд
+static void write_histogram_metrics(FILE* file, Progress* p, int metric) {
+    int64_t cumulative = 0, count = 0, sum = 0;
+    for (int i = 0; i < p->nb_slots; i++) {
+        count += counter_load(&p->slots[i].latency[metric].count);
+        sum += counter_load(&p->slots[i].latency[metric].sum);
+    }
+    for (int b = 0; b < NB_HIST_BUCKETS; b++) {
+        for (int i = 0; i < p->nb_slots; i++) {
+            cumulative += counter_load(&p->slots[i].latency[metric].buckets[b]);
+        }
+        if (b >= HIST_EXPORT_FIRST) {
+            fprintf(file, "bv2video_stage_duration_seconds_bucket{stage=\"%s\",le=\"%.6f\"} %lld\n",
+                    metric_names[metric], histogram_bound(b) / 1e6, (long long)cumulative);
+        }
+    }
+    // ͬʱģ+InfͰСǰͰ
+    fprintf(file, "bv2video_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %lld\n", metric_names[metric],
+            (long long)FFMAX(count, cumulative));
+    fprintf(file, "bv2video_stage_duration_seconds_sum{stage=\"%s\"} %.6f\n", metric_names[metric], sum / 1e6);
+    fprintf(file, "bv2video_stage_duration_seconds_count{stage=\"%s\"} %lld\n", metric_names[metric],
+            (long long)FFMAX(count, cumulative));
+}
+
+// ָдʱļ滻ָļȡһῴдһļ
+static int write_metrics(Progress* p) {
+    char tmpPath[1024];
+    int64_t read = 0, written = 0;
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", p->metrics_path);
+    FILE* file = fopen(tmpPath, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < p->nb_slots; i++) {
+        read += counter_load(&p->slots[i].bytes_read);
+        written += counter_load(&p->slots[i].bytes_written);
+    }
+    int64_t nb_total = counter_load(&p->nb_total), nb_done = counter_load(&p->nb_done);
+    int64_t nb_failed = counter_load(&p->nb_failed);
+
+    fprintf(file, "# HELP bv2video_jobs_submitted_total ύ̵߳\n");
+    fprintf(file, "# TYPE bv2video_jobs_submitted_total counter\n");
+    fprintf(file, "bv2video_jobs_submitted_total %lld\n", (long long)nb_total);
+    fprintf(file, "# HELP bv2video_jobs_total ѽ\n");
+    fprintf(file, "# TYPE bv2video_jobs_total counter\n");
+    fprintf(file, "bv2video_jobs_total{result=\"done\"} %lld\n", (long long)nb_done);
+    fprintf(file, "bv2video_jobs_total{result=\"failed\"} %lld\n", (long long)nb_failed);
+    fprintf(file, "# HELP bv2video_read_bytes_total ȡֽ\n");
+    fprintf(file, "# TYPE bv2video_read_bytes_total counter\n");
+    fprintf(file, "bv2video_read_bytes_total %lld\n", (long long)read);
+    fprintf(file, "# HELP bv2video_written_bytes_total дֽ\n");
+    fprintf(file, "# TYPE bv2video_written_bytes_total counter\n");
+    fprintf(file, "bv2video_written_bytes_total %lld\n", (long long)written);
+    fprintf(file, "# HELP bv2video_inflight_jobs ύδŶе\n");
+    fprintf(file, "# TYPE bv2video_inflight_jobs gauge\n");
+    fprintf(file, "bv2video_inflight_jobs %lld\n", (long long)FFMAX(nb_total - nb_done - nb_failed, 0));
+    fprintf(file, "# HELP bv2video_inflight_bytes ύδֽ\n");
+    fprintf(file, "# TYPE bv2video_inflight_bytes gauge\n");
+    fprintf(file, "bv2video_inflight_bytes %lld\n",
+            (long long)FFMAX(counter_load(&p->total_bytes) - counter_load(&p->done_bytes), 0));
+    fprintf(file, "# HELP bv2video_queue_depth еϢ\n");
+    fprintf(file, "# TYPE bv2video_queue_depth gauge\n");
+    mutex_lock(&p->queue_lock);
+    for (int i = 0; i < NB_PROGRESS_QUEUES; i++) {
+        int depth = p->queues[i] ? av_thread_message_queue_nb_elems(p->queues[i]) : 0;
+        fprintf(file, "bv2video_queue_depth{queue=\"%s\"} %d\n", progress_queue_names[i], FFMAX(depth, 0));
+    }
+    mutex_unlock(&p->queue_lock);
+    fprintf(file, "# HELP bv2video_stage_duration_seconds ÿ̽롢áдļβʱʱ\n");
+    fprintf(file, "# TYPE bv2video_stage_duration_seconds histogram\n");
+    for (int i = 0; i < NB_METRICS; i++) {
+        write_histogram_metrics(file, p, i);
+    }
+    if (ferror(file) | fclose(file)) {
+        remove(tmpPath);
+        return -1;
+    }
+#ifdef _WIN32
+    remove(p->metrics_path);
+#endif
+    if (rename(tmpPath, p->metrics_path) != 0) {
+        remove(tmpPath);
+        return -1;
+    }
+    return 0;
+}
+
+static THREAD_FUNC(progress_thread) {
+    Progress* p = (Progress*)arg;
+    p->last_time = p->last_metrics = av_gettime_relative();
+    while (!counter_load(&p->stop)) {
+        av_usleep(PROGRESS_POLL_INTERVAL);
+        int64_t now = av_gettime_relative();
+        if (p->interval > 0 && now - p->last_time >= p->interval) {
+            progress_sample(p, now - p->last_time);
+            p->last_time = now;
+        }
+        if (p->metrics_path && now - p->last_metrics >= METRICS_INTERVAL) {
+            if (write_metrics(p) < 0) {
+                fprintf(stderr, "޷дָļ %s\n", p->metrics_path);
+            }
+            p->last_metrics = now;
+        }
+    }
+    return 0;
+}
+
+// ̣߳nb_workersΪ߳interval0ʱÿinterval΢һνȣ
+// metrics_pathΪNULLʱдָļ
+int startProgress(int nb_workers, int64_t interval, const char* metrics_path) {
+    Progress* p = (Progress*)calloc(1, sizeof(Progress));
+    if (p == NULL) {
+        return -1;
+    }
+    p->slots = (ProgressSlot*)calloc(nb_workers, sizeof(ProgressSlot));
+    p->last_read = (int64_t*)calloc(nb_workers, sizeof(int64_t));
+    if (p->slots == NULL || p->last_read == NULL) {
+        free(p->slots);
+        free(p->last_read);
+        free(p);
+        return -1;
+    }
+    p->nb_slots = nb_workers;
+    p->interval = interval > 0 ? FFMAX(interval, PROGRESS_POLL_INTERVAL) : 0;
+    p->metrics_path = metrics_path;
+    p->scanning = 1;
+    mutex_init(&p->queue_lock);
+    if (thread_create(&p->thread, progress_thread, p) != 0) {
+        mutex_destroy(&p->queue_lock);
+        free(p->slots);
+        free(p->last_read);
+        free(p);
+        return -1;
+    }
+    progress = p;
+    return 0;
+}
+
+// ֹ̲ͣ߳ͷţ̶߳Ӧѽ
+void finishProgress(void) {
+    if (progress == NULL) {
+        return;
+    }
+    counter_store(&progress->stop, 1);
+    thread_join(progress->thread);
+    // һΣʱʱҲܿ
+    int64_t now = av_gettime_relative();
+    if (progress->interval > 0 && now > progress->last_time) {
+        progress_sample(progress, now - progress->last_time);
+    }
+    if (progress->metrics_path && write_metrics(progress) < 0) {
+        fprintf(stderr, "޷дָļ %s\n", progress->metrics_path);
+    }
+    mutex_destroy(&progress->queue_lock);
+    free(progress->slots);
+    free(progress->last_read);
+    free(progress);
+    progress = NULL;
+}
+
+// ȡļݣǰ߳ڴʱڴط䣬job_freeͷ
+char* read_file(const char* filename) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        printf("޷ļ %s\n", filename);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = (char*)job_malloc(length + 1);
+    if (data == NULL) {
+        fclose(file);
+        printf("ڴʧ\n");
+        return NULL;
+    }
+    fread(data, 1, length, file);
+    data[length] = '\0';
+    fclose(file);
+    return data;
+}
+
+// entry.jsonĿٽֻڶвҪļֵpage_dataepȣ
+// ֱڵ㡢ڴ档ַǶ׵ĶʱSSE2һμ16ֽ
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JSON_SSE2 1
+#ifdef _MSC_VER
+#include <intrin.h>
+static int json_ctz(unsigned int mask) {
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+}
+#else
+#define json_ctz(mask) __builtin_ctz(mask)
+#endif
+#endif
+
+enum {
+    JSON_NONE,      // ûҵ
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL,
+    JSON_OBJECT,
+    JSON_ARRAY,
+};
+
+// ֵԭʼıеλãַ˵ţתδ
+typedef struct {
+    const char* data;
+    size_t size;
+    int type;
+} JsonValue;
+
+static const char* json_skip_ws(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+    return p;
+}
+
+// pַָͷ֮󣬷ؽβŵλãûнβʱNULL
+static const char* json_string_end(const char* p, const char* end) {
+#ifdef JSON_SSE2
+    const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+        if (mask == 0) {
+            p += 16;
+            continue;
+        }
+        p += json_ctz(mask);
+        if (*p == '"') {
+            return p;
+        }
+        p += 2;
+    }
+#endif
+    while (p < end) {
+        if (*p == '"') {
+            return p;
+        }
+        p += *p == '\\' ? 2 : 1;
+    }
+    return NULL;
+}
+
+// pָ鿪ͷ֮󣬷ƥĽβ֮λ
+static const char* json_container_end(const char* p, const char* end) {
+    int depth = 1;
+    for (;;) {
+#ifdef JSON_SSE2
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i open = _mm_set1_epi8('{'), close = _mm_set1_epi8('}');
+        const __m128i open_array = _mm_set1_epi8('['), close_array = _mm_set1_epi8(']');
+        while (end - p >= 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
+            __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, open)),
+                                     _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, close), _mm_cmpeq_epi8(v, open_array)),
+                                                  _mm_cmpeq_epi8(v, close_array)));
+            int mask = _mm_movemask_epi8(m);
+            if (mask) {
+                p += json_ctz(mask);
+                break;
+            }
+            p += 16;
+        }
+#endif
+        while (p < end && *p != '"' && *p != '{' && *p != '}' && *p != '[' && *p != ']') {
+            p++;
+        }
+        if (p >= end) {
+            return NULL;
+        }
+        switch (*p++) {
+        case '"':
+            if ((p = json_string_end(p, end)) == NULL) {
+                return NULL;
+            }
+            p++;
+            break;
+        case '{':
+        case '[':
+            depth++;
+            break;
+        default:
+            if (--depth == 0) {
+                return p;
+            }
+            break;
+        }
+    }
+}
+
+// ȡpһֵֵ֮λãʽʱNULL
+static const char* json_value(const char* p, const char* end, JsonValue* value) {
+    const char* start = p;
+    if (p >= end) {
+        return NULL;
+    }
+    switch (*p) {
+    case '"':
+        if ((p = json_string_end(p + 1, end)) == NULL) {
+            return NULL;
+        }
+        value->data = start + 1;
+        value->size = p - start - 1;
+        value->type = JSON_STRING;
+        return p + 1;
+    case '{':
+    case '[':
+        if ((p = json_container_end(p + 1, end)) == NULL) {
+            return NULL;
+        }
+        value->type = *start == '{' ? JSON_OBJECT : JSON_ARRAY;
+        break;
+    default:
+        while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+            p++;
+        }
+        if (p == start) {
+            return NULL;
+        }
+        value->type = *start == 't' ? JSON_TRUE : *start == 'f' ? JSON_FALSE : *start == 'n' ? JSON_NULL : JSON_NUMBER;
+        break;
+    }
+    value->data = start;
+    value->size = p - start;
+    return p;
+}
+
+// ڶвkeysеļִСдͬʱȡһдvalues
+// мҵءҵļJSONʽʱ-1
+int json_find_keys(const char* json, size_t size, const char* const* keys, JsonValue* values, int nb_keys) {
+    const char* p = json, * end = json + size;
+    int found = 0;
+    for (int i = 0; i < nb_keys; i++) {
+        values[i].type = JSON_NONE;
+    }
+    p = json_skip_ws(p, end);
+    if (p >= end || *p++ != '{') {
+        return -1;
+    }
+    p = json_skip_ws(p, end);
+    if (p < end && *p == '}') {
+        return 0;
+    }
+    while (found < nb_keys) {
+        JsonValue key, value;
+        if ((p = json_value(p, end, &key)) == NULL || key.type != JSON_STRING) {
+            return -1;
+        }
+        p = json_skip_ws(p, end);
+        if (p >= end || *p++ != ':') {
+            return -1;
+        }
+        if ((p = json_value(json_skip_ws(p, end), end, &value)) == NULL) {
+            return -1;
+        }
+        for (int i = 0; i < nb_keys; i++) {
+            if (values[i].type == JSON_NONE && strlen(keys[i]) == key.size && memcmp(keys[i], key.data, key.size) == 0) {
+                values[i] = value;
+                found++;
+                break;
+            }
+        }
+        p = json_skip_ws(p, end);
+        if (p < end && *p == ',') {
+            p = json_skip_ws(p + 1, end);
+            continue;
+        }
+        if (p < end && *p == '}') {
+            break;
+        }
+        return -1;
+    }
+    return found;
+}
+
+static int json_hex4(const char* p) {
+    int v = 0;
+    for (int i = 0; i < 4; i++) {
+        int c = p[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= c - '0';
+        else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+        else return -1;
+    }
+    return v;
+}
+
+// ֵַԭΪUTF-8ת\uXXXXԣoutĲֽضϡ
+// ֵַתʽʱ-1
+int json_get_string(const JsonValue* value, char* out, size_t size) {
+    const char* p = value->data, * end = value->data + value->size;
+    size_t n = 0;
+    if (value->type != JSON_STRING || size == 0) {
+        return -1;
+    }
+    while (p < end) {
+        char buf[4];
+        int len = 1;
+        if (*p != '\\') {
+            buf[0] = *p++;
+        }
+        else {
+            if (end - p < 2) {
+                return -1;
+            }
+            char c = p[1];
+            p += 2;
+            switch (c) {
+            case '"': case '\\': case '/': buf[0] = c; break;
+            case 'b': buf[0] = '\b'; break;
+            case 'f': buf[0] = '\f'; break;
+            case 'n': buf[0] = '\n'; break;
+            case 'r': buf[0] = '\r'; break;
+            case 't': buf[0] = '\t'; break;
+            case 'u': {
+                int cp = end - p >= 4 ? json_hex4(p) : -1;
+                if (cp < 0) {
+                    return -1;
+                }
+                p += 4;
+                if (cp >= 0xD800 && cp < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                    int low = json_hex4(p + 2);
+                    if (low >= 0xDC00 && low < 0xE000) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        p += 6;
+                    }
+                }
+                if (cp < 0x80) {
+                    buf[0] = (char)cp;
+                }
+                else if (cp < 0x800) {
+                    buf[0] = (char)(0xC0 | (cp >> 6));
+                    buf[1] = (char)(0x80 | (cp & 0x3F));
+                    len = 2;
+                }
+                else if (cp < 0x10000) {
+                    buf[0] = (char)(0xE0 | (cp >> 12));
+                    buf[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    buf[2] = (char)(0x80 | (cp & 0x3F));
+                    len = 3;
+                }
+                else {
+                    buf[0] = (char)(0xF0 | (cp >> 18));
+                    buf[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+                    buf[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    buf[3] = (char)(0x80 | (cp & 0x3F));
+                    len = 4;
+                }
+                break;
+            }
+            default:
+                return -1;
+            }
+        }
+        if (n + len >= size) {
+            break;
+        }
+        memcpy(out + n, buf, len);
+        n += len;
+    }
+    out[n] = '\0';
+    return 0;
+}
+
+// ֵ͵ֵתΪdoubleֵʱ0
+static double json_get_number(const JsonValue* value) {
+    char buf[64];
+    if (value->type != JSON_NUMBER || value->size >= sizeof(buf)) {
+        return 0;
+    }
+    memcpy(buf, value->data, value->size);
+    buf[value->size] = '\0';
+    return strtod(buf, NULL);
+}
+// ϲ
+enum {
+    MERGE_ENGINE_LAVF,  // ͨlibavformat⸴á
+    MERGE_ENGINE_BOX,   // ֱƴfMP4ӣ֧ʱ˵libavformat
+};
+
+// ϲ
+typedef struct {
+    int fast_probe;     // ̽⣺ʱavformat_find_stream_info
+    int engine;
+    int64_t frag_duration;  // 0ʱֶMP4ΪƬʱ΢룩
+    int faststart;          // moovļͷ
+    int dry_run;            // ֻɨ衢ļϲ
+    int64_t prefetch_budget;    // ŶԤޣֽڣΪ0ʱԤ
+} MergeOptions;
+
+// faststartʵַʽ
+enum {
+    FASTSTART_NONE,
+    FASTSTART_RESERVE,  // ԤmoovСļͷԤֻдһ
+    FASTSTART_REWRITE,  // дɸmoovƵͷ+faststartдһ
+};
+
+// ̽ʱ̽ͷʱ
+#define FAST_PROBE_SIZE "1048576"
+#define FAST_ANALYZE_DURATION "500000"
+
+// Ѵ򿪵лȡƵ֡ʣȡʱ0
+double get_frame_rate(AVFormatContext* format_ctx) {
+    AVStream* video_stream = NULL;
+    double frame_rate = 0.0;
+
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+        if (format_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            video_stream = format_ctx->streams[i];
+            break;
+        }
+    }
+
+    if (video_stream) {
+        AVRational frame_rate_rational = av_guess_frame_rate(format_ctx, video_stream, NULL);
+        frame_rate = av_q2d(frame_rate_rational);
+    }
+    return frame_rate;
+}
+
+// ǷֱӸfMP4ĳʼΣmoovͨѾ
+// ȫʱҪٶȡݰ
+static int codecpar_complete(const AVCodecParameters* par) {
+    switch (par->codec_id) {
+    case AV_CODEC_ID_NONE:
+        return 0;
+    case AV_CODEC_ID_H264:
+    case AV_CODEC_ID_HEVC:
+    case AV_CODEC_ID_AV1:
+    case AV_CODEC_ID_AAC:
+        if (par->extradata_size <= 0) {
+            return 0;
+        }
+        break;
+    default:
+        break;
+    }
+    if (par->codec_type == AVMEDIA_TYPE_VIDEO) {
+        return par->width > 0 && par->height > 0;
+    }
+    if (par->codec_type == AVMEDIA_TYPE_AUDIO) {
+        return par->sample_rate > 0 && par->ch_layout.nb_channels > 0;
+    }
+    return 0;
+}
+
+// ȡļԶAVIOContextн
+typedef struct {
+    int fd;
+} FileInput;
+
+#define FILE_INPUT_BUFFER_SIZE (64 << 10)
+
+static int file_input_read(void* opaque, uint8_t* buf, int buf_size) {
+    FileInput* in = (FileInput*)opaque;
+    int n;
+    do {
+        n = (int)fd_read(in->fd, buf, (unsigned)buf_size);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return AVERROR(errno);
+    }
+    if (n == 0) {
+        return AVERROR_EOF;
+    }
+    progress_read(n);
+    return n;
+}
+
+static int64_t file_input_seek(void* opaque, int64_t offset, int whence) {
+    FileInput* in = (FileInput*)opaque;
+    int64_t pos;
+    if (whence & AVSEEK_SIZE) {
+        int64_t cur = fd_seek(in->fd, 0, SEEK_CUR);
+        pos = fd_seek(in->fd, 0, SEEK_END);
+        fd_seek(in->fd, cur, SEEK_SET);
+    }
+    else {
+        pos = fd_seek(in->fd, offset, whence & ~AVSEEK_FORCE);
+    }
+    return pos < 0 ? AVERROR(errno) : pos;
+}
+
+static int open_file_input(AVIOContext** pb, const char* filename) {
+    FileInput* in = (FileInput*)av_mallocz(sizeof(FileInput));
+    uint8_t* buffer = (uint8_t*)av_malloc(FILE_INPUT_BUFFER_SIZE);
+    if (in == NULL || buffer == NULL) {
+        av_free(in);
+        av_free(buffer);
+        return AVERROR(ENOMEM);
+    }
+    in->fd = fd_open_read(filename);
+    if (in->fd < 0) {
+        int ret = AVERROR(errno);
+        av_free(in);
+        av_free(buffer);
+        return ret;
+    }
+    *pb = avio_alloc_context(buffer, FILE_INPUT_BUFFER_SIZE, 0, in, file_input_read, NULL, file_input_seek);
+    if (*pb == NULL) {
+        fd_close(in->fd);
+        av_free(in);
+        av_free(buffer);
+        return AVERROR(ENOMEM);
+    }
+    mem_acquire(*pb);
+    return 0;
+}
+
+static void close_file_input(AVIOContext** pb) {
+    if (*pb == NULL) {
+        return;
+    }
+    FileInput* in = (FileInput*)(*pb)->opaque;
+    fd_close(in->fd);
+    av_free(in);
+    av_freep(&(*pb)->buffer);
+    mem_release(*pb);
+    avio_context_free(pb);
+}
+
+// ʹԶAVIOavformat_close_input()ر
+static void close_merge_input(AVFormatContext** ctx) {
+    AVIOContext* pb = *ctx ? (*ctx)->pb : NULL;
+    mem_release(*ctx);
+    avformat_close_input(ctx);
+    close_file_input(&pb);
+}
+
+// ļȡϢÿֻһ
+static int open_merge_input(AVFormatContext** ctx, const char* filename, const MergeOptions* options) {
+    AVDictionary* format_opts = NULL;
+    int ret;
+
+    if (options->fast_probe) {
+        av_dict_set(&format_opts, "probesize", FAST_PROBE_SIZE, 0);
+        av_dict_set(&format_opts, "analyzeduration", FAST_ANALYZE_DURATION, 0);
+    }
+    AVIOContext* pb = NULL;
+    int64_t start = stage_begin();
+    if ((ret = open_file_input(&pb, filename)) >= 0) {
+        if ((*ctx = avformat_alloc_context()) == NULL) {
+            ret = AVERROR(ENOMEM);
+        }
+        else {
+            (*ctx)->pb = pb;
+            ret = avformat_open_input(ctx, filename, NULL, &format_opts);
+        }
+    }
+    stage_end(STAGE_OPEN_INPUT, start);
+    av_dict_free(&format_opts);
+    if (ret < 0) {
+        close_file_input(&pb);
+        return ret;
+    }
+    mem_acquire(*ctx);
+
+    if (options->fast_probe && (*ctx)->nb_streams > 0) {
+        int complete = 1;
+        for (unsigned int i = 0; i < (*ctx)->nb_streams; i++) {
+            if (!codecpar_complete((*ctx)->streams[i]->codecpar)) {
+                complete = 0;
+                break;
+            }
+        }
+        if (complete) {
+            return 0;
+        }
+    }
+    start = stage_begin();
+    ret = avformat_find_stream_info(*ctx, NULL);
+    stage_end(STAGE_FIND_STREAM_INFO, start);
+    if (ret < 0) {
+        fprintf(stderr, "޷ȡ %s Ϣ\n", filename);
+        close_merge_input(ctx);
+        return ret;
+    }
+    return 0;
+}
+
+// ԤÿɵĶȡ̵߳av_read_frame()ֻϲİ
+// нFIFOϲѭFIFOȡһĴ̻ȴһĶȡ
+// Ҳ븴áдصFIFOƣڴռƵʱ޹
+#define READ_AHEAD_PACKETS 256
+#define READ_AHEAD_BYTES (8 << 20)
+
+typedef struct {
+    AVFormatContext* ctx;
+    int stream_index;
+    AVFifo* fifo;           // AVPacket*ΪNULLʱȡ߳û
+    int64_t bytes;          // FIFOݰܴС
+    int done;               // ȡ߳ѽ
+    int error;              // ȡ߳̽ʱav_read_frame()ķֵ
+    int abort;              // ϲѭȡȡ߳Ӧ˳
+    mutex_t lock;
+    cond_t cond;            // FIFOݡ˿ռ䡢ȡҪ˳
+    thread_t thread;
+    ProgressSlot* progress; // ȡȡ̵߳Ĺ߳
+} InputReader;
+
+static THREAD_FUNC(input_reader_thread) {
+    InputReader* r = (InputReader*)arg;
+    AVPacket* pkt = NULL;
+    int ret;
+
+    thread_progress = r->progress;
+    for (;;) {
+        if (pkt == NULL && (pkt = av_packet_alloc()) == NULL) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        if ((ret = av_read_frame(r->ctx, pkt)) < 0) {
+            break;
+        }
+        if (pkt->stream_index != r->stream_index) {
+            av_packet_unref(pkt);
+            continue;
+        }
+        mutex_lock(&r->lock);
+        while (!r->abort && (av_fifo_can_write(r->fifo) == 0 || r->bytes >= READ_AHEAD_BYTES)) {
+            cond_wait(&r->cond, &r->lock);
+        }
+        if (r->abort) {
+            mutex_unlock(&r->lock);
+            ret = AVERROR_EXIT;
+            break;
+        }
+        r->bytes += pkt->size;
+        av_fifo_write(r->fifo, &pkt, 1);
+        pkt = NULL;
+        cond_broadcast(&r->cond);
+        mutex_unlock(&r->lock);
+    }
+    av_packet_free(&pkt);
+    mutex_lock(&r->lock);
+    r->error = ret;
+    r->done = 1;
+    cond_broadcast(&r->cond);
+    mutex_unlock(&r->lock);
+    return 0;
+}
+
+// Ķȡ߳
+static int start_input_reader(InputReader* r, AVFormatContext* ctx, int stream_index) {
+    r->ctx = ctx;
+    r->stream_index = stream_index;
+    r->fifo = av_fifo_alloc2(READ_AHEAD_PACKETS, sizeof(AVPacket*), 0);
+    if (r->fifo == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    mutex_init(&r->lock);
+    cond_init(&r->cond);
+    r->progress = thread_progress;
+    if (thread_create(&r->thread, input_reader_thread, r) != 0) {
+        mutex_destroy(&r->lock);
+        cond_destroy(&r->cond);
+        av_fifo_freep2(&r->fifo);
+        return AVERROR(EAGAIN);
+    }
+    mem_acquire(r->fifo);
+    return 0;
+}
+
+// FIFOȡһFIFOΪʱȴȡ̣߳ȡ󷵻av_read_frame()ķֵ
+// ʱΪAVERROR_EOF
+static int input_reader_get(InputReader* r, AVPacket* pkt) {
+    AVPacket* queued = NULL;
+    int ret = 0;
+    mutex_lock(&r->lock);
+    while (av_fifo_can_read(r->fifo) == 0 && !r->done) {
+        cond_wait(&r->cond, &r->lock);
+    }
+    if (av_fifo_read(r->fifo, &queued, 1) >= 0) {
+        r->bytes -= queued->size;
+        cond_broadcast(&r->cond);
+    }
+    else {
+        ret = r->error;
+    }
+    mutex_unlock(&r->lock);
+    if (queued) {
+        av_packet_move_ref(pkt, queued);
+        av_packet_free(&queued);
+    }
+    return ret;
+}
+
+// öȡ߳˳ͷFIFOʣİ
+static void stop_input_reader(InputReader* r) {
+    AVPacket* pkt;
+    if (r->fifo == NULL) {
+        return;
+    }
+    mutex_lock(&r->lock);
+    r->abort = 1;
+    cond_broadcast(&r->cond);
+    mutex_unlock(&r->lock);
+    thread_join(r->thread);
+    while (av_fifo_read(r->fifo, &pkt, 1) >= 0) {
+        av_packet_free(&pkt);
+    }
+    mutex_destroy(&r->lock);
+    cond_destroy(&r->cond);
+    mem_release(r->fifo);
+    av_fifo_freep2(&r->fifo);
+}
+
+// ϲ룺ÿļһѶдİDTSС
+typedef struct {
+    AVFormatContext* ctx;
+    int stream_index;       // ϲ
+    AVStream* out_stream;
+    AVPacket* pkt;
+    int64_t dts;            // дDTSλAV_TIME_BASE_Q
+    int order;              // DTSͬʱ˳д
+    InputReader reader;
+} MergeInput;
+
+// Ӷȡ߳ȡһдʱAVERROR_EOFȡʱ
+static int read_merge_input(MergeInput* in) {
+    int ret = input_reader_get(&in->reader, in->pkt);
+    if (ret < 0) {
+        return ret;
+    }
+    AVStream* st = in->ctx->streams[in->stream_index];
+    int64_t ts = in->pkt->dts != AV_NOPTS_VALUE ? in->pkt->dts : in->pkt->pts;
+    // ûʱİһDTS˳򲻱
+    if (ts != AV_NOPTS_VALUE) {
+        in->dts = av_rescale_q(ts, st->time_base, AV_TIME_BASE_Q);
+    }
+    return 0;
+}
+
+static int merge_input_less(const MergeInput* a, const MergeInput* b) {
+    return a->dts < b->dts || (a->dts == b->dts && a->order < b->order);
+}
+
+static void merge_heap_push(MergeInput** heap, int* size, MergeInput* in) {
+    int i = (*size)++;
+    while (i > 0 && merge_input_less(in, heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = in;
+}
+
+static MergeInput* merge_heap_pop(MergeInput** heap, int* size) {
+    MergeInput* top = heap[0];
+    MergeInput* last = heap[--(*size)];
+    int i = 0;
+    for (;;) {
+        int child = i * 2 + 1;
+        if (child >= *size) {
+            break;
+        }
+        if (child + 1 < *size && merge_input_less(heap[child + 1], heap[child])) {
+            child++;
+        }
+        if (!merge_input_less(heap[child], last)) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (*size > 0) {
+        heap[i] = last;
+    }
+    return top;
+}
+
+// 㸴֯еĴСѽȥд
+// ͨMP4ݰ뿪ʱԭдmdatֶMP4дƬʱһд룬֮Ǹлݡ
+// endsύ˳¼ÿݰۼƽλãеİ
+typedef struct {
+    AVIOContext* pb;
+    int64_t base;           // ļͷ֮λ
+    int64_t submitted;
+    int64_t* ends;
+    int head;
+    int count;
+    int capacity;
+} MuxerQueue;
+
+static void muxer_queue_push(MuxerQueue* q, int size) {
+    q->submitted += size;
+    if (q->count == q->capacity) {
+        int capacity = q->capacity ? q->capacity * 2 : 64;
+        int64_t* ends = (int64_t*)av_malloc_array(capacity, sizeof(int64_t));
+        if (ends == NULL) {
+            return;
+        }
+        for (int i = 0; i < q->count; i++) {
+            ends[i] = q->ends[(q->head + i) % q->capacity];
+        }
+        av_free(q->ends);
+        q->ends = ends;
+        q->head = 0;
+        q->capacity = capacity;
+    }
+    q->ends[(q->head + q->count++) % q->capacity] = q->submitted;
+}
+
+// ݰ¹㣬¼е
+static void muxer_queue_update(MuxerQueue* q) {
+    int64_t written = avio_tell(q->pb) - q->base;
+    while (q->count > 0 && q->ends[q->head] <= written) {
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+    }
+    thread_stats->queue_packets = FFMAX(thread_stats->queue_packets, q->count);
+    thread_stats->queue_bytes = FFMAX(thread_stats->queue_bytes, q->submitted - written);
+}
+
+// DTSСδӸȡдֻ֯
+// ڴռƵʱ޹أļƵҲǽе
+int interleave_inputs(AVFormatContext* output_format_ctx, MergeInput* inputs, int nb_inputs) {
+    MergeInput** heap = (MergeInput**)av_calloc(nb_inputs, sizeof(MergeInput*));
+    MuxerQueue pending = { 0 };
+    int heap_size = 0;
+    int ret = 0;
+
+    pending.pb = output_format_ctx->pb;
+
+    if (heap == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    for (int i = 0; i < nb_inputs; i++) {
+        inputs[i].order = i;
+        inputs[i].dts = INT64_MIN;
+        inputs[i].pkt = av_packet_alloc();
+        mem_acquire(inputs[i].pkt);
+        if (inputs[i].pkt == NULL) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        if ((ret = start_input_reader(&inputs[i].reader, inputs[i].ctx, inputs[i].stream_index)) < 0) {
+            fprintf(stderr, "޷ȡ̡߳\n");
+            goto end;
+        }
+    }
+    for (int i = 0; i < nb_inputs; i++) {
+        if ((ret = read_merge_input(&inputs[i])) >= 0) {
+            merge_heap_push(heap, &heap_size, &inputs[i]);
+        }
+        else if (ret != AVERROR_EOF) {
+            fprintf(stderr, "ȡݰʧܡ\n");
+            goto end;
+        }
+    }
+    ret = 0;
+
+    if (pending.pb) {
+        pending.base = avio_tell(pending.pb);
+    }
+    while (heap_size > 0) {
+        MergeInput* in = merge_heap_pop(heap, &heap_size);
+        AVStream* st = in->ctx->streams[in->stream_index];
+        in->pkt->stream_index = in->out_stream->index;
+        av_packet_rescale_ts(in->pkt, st->time_base, in->out_stream->time_base);
+        int size = in->pkt->size;
+        if ((ret = av_interleaved_write_frame(output_format_ctx, in->pkt)) < 0) {
+            fprintf(stderr, "дݰʧܡ\n");
+            goto end;
+        }
+        progress_write(size);
+        if (thread_stats) {
+            thread_stats->packets++;
+            if (pending.pb) {
+                muxer_queue_push(&pending, size);
+                muxer_queue_update(&pending);
+            }
+        }
+        if ((ret = read_merge_input(in)) >= 0) {
+            merge_heap_push(heap, &heap_size, in);
+        }
+        else if (ret != AVERROR_EOF) {
+            fprintf(stderr, "ȡݰʧܡ\n");
+            goto end;
+        }
+        ret = 0;
+    }
+
+end:
+    for (int i = 0; i < nb_inputs; i++) {
+        stop_input_reader(&inputs[i].reader);
+        mem_release(inputs[i].pkt);
+        av_packet_free(&inputs[i].pkt);
+    }
+    av_free(heap);
+    av_free(pending.ends);
+    return ret;
+}
+
+static int64_t estimate_moov_size(const char* audio_file, const char* video_file,
+                                  const AVStream* out_audio_stream, const AVStream* out_video_stream);
+static int open_async_output(AVIOContext** pb, const char* output_file);
+static int close_async_output(AVIOContext** pb);
+
+// رոдеĴ
+static int close_merge_output(AVFormatContext* ctx, int async) {
+    int ret = 0;
+    if (!(ctx->oformat->flags & AVFMT_NOFILE) && ctx->pb) {
+        if (async) {
+            ret = close_async_output(&ctx->pb);
+        }
+        else {
+            mem_release(ctx->pb);
+            avio_closep(&ctx->pb);
+        }
+    }
+    return ret;
+}
+
+int merge_audio_video(const char* audio_file, const char* video_file, const char* output_file, const MergeOptions* options) {
+    AVFormatContext* input_format_ctx_audio = NULL, * input_format_ctx_video = NULL, * output_format_ctx = NULL;
+    AVStream* audio_stream = NULL, * video_stream = NULL, * out_audio_stream = NULL, * out_video_stream = NULL;
+    AVDictionary* muxer_opts = NULL;
+    int64_t moov_size = -1;
+    int64_t start;
+    int async_output = 1;   // д߳첽д
+    int ret;
+    double frame_rate;
+
+    // ļ
+    if ((ret = open_merge_input(&input_format_ctx_audio, audio_file, options)) < 0) {
+        fprintf(stderr, "޷Ƶļ\n");
+        goto end;
+    }
+    if ((ret = open_merge_input(&input_format_ctx_video, video_file, options)) < 0) {
+        fprintf(stderr, "޷Ƶļ\n");
+        goto end;
+    }
+
+    // ֱӴѴ򿪵Ƶȡ֡
+    frame_rate = get_frame_rate(input_format_ctx_video);
+    // дʱļܰչ²ʽ
+    avformat_alloc_output_context2(&output_format_ctx, NULL, "mp4", output_file);
+    if (!output_format_ctx) {
+        fprintf(stderr, "޷ġ\n");
+        ret = AVERROR_UNKNOWN;
+        goto end;
+    }
+    mem_acquire(output_format_ctx);
+
+    // Ƶ
+    audio_stream = input_format_ctx_audio->streams[0];
+    out_audio_stream = avformat_new_stream(output_format_ctx, NULL);
+    if (!out_audio_stream) {
+        fprintf(stderr, "޷Ƶ\n");
+        ret = AVERROR_UNKNOWN;
+        goto end;
+    }
+    if ((ret = avcodec_parameters_copy(out_audio_stream->codecpar, audio_stream->codecpar)) < 0) {
+        fprintf(stderr, "޷Ƶ\n");
+        goto end;
+    }
+    out_audio_stream->time_base = audio_stream->time_base;
+
+    // Ƶ
+    video_stream = input_format_ctx_video->streams[0];
+    out_video_stream = avformat_new_stream(output_format_ctx, NULL);
+    if (!out_video_stream) {
+        fprintf(stderr, "޷Ƶ\n");
+        ret = AVERROR_UNKNOWN;
+        goto end;
+    }
+    if ((ret = avcodec_parameters_copy(out_video_stream->codecpar, video_stream->codecpar)) < 0) {
+        fprintf(stderr, "޷Ƶ\n");
+        goto end;
+    }
+    // ̽ʱͨò֡ʣʱʱ
+    // ԤmoovʱҲʱʱܾȷ㣬moovСԤ׼ȷ
+    if (frame_rate >= 1.0 && options->faststart != FASTSTART_RESERVE) {
+        out_video_stream->time_base = (AVRational){ 1, (int)frame_rate };
+    }
+    else {
+        out_video_stream->time_base = video_stream->time_base;
+    }
+    out_video_stream->codecpar->codec_tag = 0;
+
+    // ֶMP4moovϴӹؼ֡ʼķƬٻļ
+    // ڴռʱ޹أÿƬд꼴ˢµļд;жֻʧһƬ
+    if (options->frag_duration > 0) {
+        av_dict_set(&muxer_opts, "movflags", "+frag_keyframe+empty_moov+default_base_moof", 0);
+        av_dict_set_int(&muxer_opts, "min_frag_duration", options->frag_duration, 0);
+        av_dict_set(&muxer_opts, "flush_packets", "1", 0);
+    }
+    // дfaststartǴfMP4ʹСȿ֪
+    // ԤmoovСļͷԤռ䣬av_write_trailer()ʱmoovֱдԤ
+    start = stage_begin();
+    if (options->frag_duration <= 0 && options->faststart == FASTSTART_RESERVE) {
+        moov_size = estimate_moov_size(audio_file, video_file, out_audio_stream, out_video_stream);
+        if (moov_size > 0) {
+            av_dict_set_int(&muxer_opts, "moov_size", moov_size, 0);
+        }
+        else {
+            fprintf(stderr, "޷ԤmoovСΪдƶmoov\n");
+        }
+    }
+    if (options->frag_duration <= 0 && options->faststart != FASTSTART_NONE && moov_size <= 0) {
+        av_dict_set(&muxer_opts, "movflags", "+faststart", 0);
+        // ƶmoovʱļ´дݣдѾ䵽ļУ
+        // ֻͬд
+        async_output = 0;
+    }
+
+    // ļ
+    if (!(output_format_ctx->oformat->flags & AVFMT_NOFILE)) {
+        if (async_output) {
+            ret = open_async_output(&output_format_ctx->pb, output_file);
+        }
+        else if ((ret = avio_open(&output_format_ctx->pb, output_file, AVIO_FLAG_WRITE)) >= 0) {
+            mem_acquire(output_format_ctx->pb);
+        }
+        if (ret < 0) {
+            fprintf(stderr, "޷ļ\n");
+            goto end;
+        }
+    }
+    ret = avformat_write_header(output_format_ctx, &muxer_opts);
+    stage_end(STAGE_WRITE_HEADER, start);
+    if (ret < 0) {
+        fprintf(stderr, "ļʱ\n");
+        goto end;
+    }
+
+    // DTSдƵݰ
+    MergeInput inputs[2] = {
+        { .ctx = input_format_ctx_audio, .stream_index = audio_stream->index, .out_stream = out_audio_stream },
+        { .ctx = input_format_ctx_video, .stream_index = video_stream->index, .out_stream = out_video_stream },
+    };
+    start = stage_begin();
+    ret = interleave_inputs(output_format_ctx, inputs, 2);
+    stage_end(STAGE_COPY, start);
+    if (ret < 0) {
+        fprintf(stderr, "ϲƵݰʱ\n");
+        goto end;
+    }
+
+    start = stage_begin();
+    ret = av_write_trailer(output_format_ctx);
+    // ԤĿռŲmoovʱmovEINVALļ𻵣ɵ÷+faststartºϲ
+    // 󣨴ȣºϲҲ޼£ԭ
+    if (ret == AVERROR(EINVAL) && moov_size > 0) {
+        ret = AVERROR_BUFFER_TOO_SMALL;
+    }
+    else if (ret < 0) {
+        fprintf(stderr, "дļβʱ\n");
+    }
+    int close_ret = close_merge_output(output_format_ctx, async_output);
+    if (close_ret < 0 && ret >= 0) {
+        fprintf(stderr, "дļʱ\n");
+        ret = close_ret;
+    }
+    stage_end(STAGE_TRAILER, start);
+
+end:
+    av_dict_free(&muxer_opts);
+    close_merge_input(&input_format_ctx_audio);
+    close_merge_input(&input_format_ctx_video);
+    if (output_format_ctx) {
+        close_merge_output(output_format_ctx, async_output);
+        mem_release(output_format_ctx);
+        avformat_free_context(output_format_ctx);
+    }
+    return ret < 0 ? ret : 0;
+}
+
+
+
+// ---------------- ļ ----------------
+// ļԶAVIOContextͷݾAVIOд룻
+// εغtransfer_payload()ֱӴļ䵽ļ
+// ںʱͲû̬
+
+typedef struct {
+    int fd;
+    int64_t block_size;     // ļϵͳСreflinkҪ󰴿
+} FileOutput;
+
+#define FILE_OUTPUT_BUFFER_SIZE (256 << 10)
+#define COPY_BUFFER_SIZE (1 << 20)
+// СڸôСݲֵΪreflink
+#define REFLINK_MIN_SIZE (64 << 10)
+
+static int write_all(int fd, const uint8_t* buf, int64_t size) {
+    while (size > 0) {
+        int n = (int)fd_write(fd, buf, (unsigned)FFMIN(size, INT_MAX));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return AVERROR(errno);
+        }
+        buf += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int file_output_write(void* opaque, const uint8_t* buf, int buf_size) {
+    FileOutput* out = (FileOutput*)opaque;
+    int ret = write_all(out->fd, buf, buf_size);
+    if (ret < 0) {
+        return ret;
+    }
+    progress_write(buf_size);
+    return buf_size;
+}
+
+static int64_t file_output_seek(void* opaque, int64_t offset, int whence) {
+    FileOutput* out = (FileOutput*)opaque;
+    int64_t pos;
+    if (whence & AVSEEK_SIZE) {
+        int64_t cur = fd_seek(out->fd, 0, SEEK_CUR);
+        pos = fd_seek(out->fd, 0, SEEK_END);
+        fd_seek(out->fd, cur, SEEK_SET);
+    }
+    else {
+        pos = fd_seek(out->fd, offset, whence & ~AVSEEK_FORCE);
+    }
+    return pos < 0 ? AVERROR(errno) : pos;
+}
+
+// дoutput_fileԶAVIOContext
+static int open_file_output(AVIOContext** pb, const char* output_file) {
+    FileOutput* out = (FileOutput*)av_mallocz(sizeof(FileOutput));
+    uint8_t* buffer = (uint8_t*)av_malloc(FILE_OUTPUT_BUFFER_SIZE);
+    if (out == NULL || buffer == NULL) {
+        av_free(out);
+        av_free(buffer);
+        return AVERROR(ENOMEM);
+    }
+    out->fd = fd_open_write(output_file);
+    if (out->fd < 0) {
+        int ret = AVERROR(errno);
+        av_free(out);
+        av_free(buffer);
+        return ret;
+    }
+    out->block_size = 4096;
+#ifndef _WIN32
+    struct stat st;
+    if (fstat(out->fd, &st) == 0 && st.st_blksize > 0) {
+        out->block_size = st.st_blksize;
+    }
+#endif
+    *pb = avio_alloc_context(buffer, FILE_OUTPUT_BUFFER_SIZE, 1, out, NULL, file_output_write, file_output_seek);
+    if (*pb == NULL) {
+        fd_close(out->fd);
+        av_free(out);
+        av_free(buffer);
+        return AVERROR(ENOMEM);
+    }
+    mem_acquire(*pb);
+    return 0;
+}
+
+// дʣݲرдеĴ
+static int close_file_output(AVIOContext** pb) {
+    int ret;
+    if (*pb == NULL) {
+        return 0;
+    }
+    avio_flush(*pb);
+    ret = (*pb)->error;
+    FileOutput* out = (FileOutput*)(*pb)->opaque;
+    if (fd_close(out->fd) < 0 && ret >= 0) {
+        ret = AVERROR(errno);
+    }
+    av_free(out);
+    av_freep(&(*pb)->buffer);
+    mem_release(*pb);
+    avio_context_free(pb);
+    return ret;
+}
+
+// λͬһ֧reflinkļϵͳbtrfsXFSʱ1
+static int reflink_possible(int in_fd, AVIOContext* pb) {
+#if defined(__linux__) && defined(FICLONERANGE)
+    FileOutput* out = (FileOutput*)pb->opaque;
+    struct stat in_st, out_st;
+    struct statfs fs;
+    if (fstat(in_fd, &in_st) < 0 || fstat(out->fd, &out_st) < 0 || in_st.st_dev != out_st.st_dev) {
+        return 0;
+    }
+    if (fstatfs(out->fd, &fs) < 0) {
+        return 0;
+    }
+    return fs.f_type == 0x9123683E /* btrfs */ || fs.f_type == 0x58465342 /* XFS */;
+#else
+    return 0;
+#endif
+}
+
+// еһݿָλãcopy_file_rangeںп
+// ֧ʱļϵͳں˵ȣ˻صû̬д
+static int copy_range(int in_fd, int out_fd, int64_t src, int64_t dst, int64_t len, uint8_t* buf) {
+#ifdef __linux__
+    while (len > 0) {
+        loff_t in_off = src, out_off = dst;
+        ssize_t n = copy_file_range(in_fd, &in_off, out_fd, &out_off, (size_t)len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        src += n;
+        dst += n;
+        len -= n;
+    }
+    if (len == 0) {
+        return 0;
+    }
+#endif
+    if (fd_seek(in_fd, src, SEEK_SET) < 0 || fd_seek(out_fd, dst, SEEK_SET) < 0) {
+        return AVERROR(errno);
+    }
+    while (len > 0) {
+        int n = (int)fd_read(in_fd, buf, (unsigned)FFMIN(len, COPY_BUFFER_SIZE));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return n < 0 ? AVERROR(errno) : AVERROR(EIO);
+        }
+        int ret = write_all(out_fd, buf, n);
+        if (ret < 0) {
+            return ret;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+// ļ[pos, pos+size)׷ӵдAVIOеݣ
+// ĿƫͬʱFICLONERANGEмݿ飬
+// βһĲֺcopy_range()reflinkʧܺ*reflink㣬ٳ
+static int transfer_payload(AVIOContext* pb, int in_fd, int* reflink, int64_t pos, int64_t size, uint8_t* buf) {
+    FileOutput* out = (FileOutput*)pb->opaque;
+    int64_t dst, done = 0;
+    int ret;
+
+    avio_flush(pb);
+    if (pb->error < 0) {
+        return pb->error;
+    }
+    dst = avio_tell(pb);
+#if defined(__linux__) && defined(FICLONERANGE)
+    if (*reflink && (pos - dst) % out->block_size == 0) {
+        int64_t head = (out->block_size - pos % out->block_size) % out->block_size;
+        int64_t len = (size - head) / out->block_size * out->block_size;
+        if (len > 0) {
+            if ((ret = copy_range(in_fd, out->fd, pos, dst, head, buf)) < 0) {
+                return ret;
+            }
+            struct file_clone_range range;
+            range.src_fd = in_fd;
+            range.src_offset = pos + head;
+            range.src_length = len;
+            range.dest_offset = dst + head;
+            if (ioctl(out->fd, FICLONERANGE, &range) == 0) {
+                done = head + len;
+            }
+            else {
+                *reflink = 0;
+                done = head;
+            }
+        }
+    }
+#endif
+    if ((ret = copy_range(in_fd, out->fd, pos + done, dst + done, size - done, buf)) < 0) {
+        return ret;
+    }
+    progress_read(size);
+    progress_write(size);
+    // ƹAVIO壬AVIOдλƵĩβ
+    if (avio_seek(pb, dst + size, SEEK_SET) < 0) {
+        return AVERROR(EIO);
+    }
+    return 0;
+}
+
+// ---------------- 첽 ----------------
+// libavformatʱʹõAVIOĻдƵһ󻺳нд̣߳
+// ASYNC_OUTPUT_BUFFERSдͬʱŶӣֻ߳ȫ嶼Ŷʱŵȴ̡
+// ÿдļڵƫƣͷ޲mdatmoovСʱseekֻı߼λã
+// д̰߳ύ˳ִУύ޲һд
+#define ASYNC_OUTPUT_BUFFER_SIZE (1 << 20)
+#define ASYNC_OUTPUT_BUFFERS 4
+
+typedef struct {
+    uint8_t* data;
+    int64_t pos;
+    int size;
+} AsyncWrite;
+
+typedef struct {
+    int fd;
+    AsyncWrite writes[ASYNC_OUTPUT_BUFFERS];    // ζУڶѭʹ
+    int head;               // һҪдд
+    int count;              // ύδдд
+    int error;              // һд
+    int stop;
+    int64_t pos;            // ߼дλãֻڸ߳ʹ
+    int64_t size;           // ߼ļСֻڸ߳ʹ
+    mutex_t lock;
+    cond_t cond;            // µд롢дһдҪ˳
+    thread_t thread;
+} AsyncOutput;
+
+static THREAD_FUNC(async_output_thread) {
+    AsyncOutput* out = (AsyncOutput*)arg;
+    int64_t file_pos = 0;
+    mutex_lock(&out->lock);
+    for (;;) {
+        while (out->count == 0 && !out->stop) {
+            cond_wait(&out->cond, &out->lock);
+        }
+        if (out->count == 0) {
+            break;
+        }
+        AsyncWrite* w = &out->writes[out->head];
+        int ret = 0;
+        mutex_unlock(&out->lock);
+        // ˳дʱƶļλ
+        if (w->pos != file_pos && fd_seek(out->fd, w->pos, SEEK_SET) < 0) {
+            ret = AVERROR(errno);
+        }
+        if (ret == 0) {
+            ret = write_all(out->fd, w->data, w->size);
+        }
+        file_pos = ret == 0 ? w->pos + w->size : -1;
+        mutex_lock(&out->lock);
+        if (ret < 0 && out->error == 0) {
+            out->error = ret;
+        }
+        out->head = (out->head + 1) % ASYNC_OUTPUT_BUFFERS;
+        out->count--;
+        cond_broadcast(&out->cond);
+    }
+    mutex_unlock(&out->lock);
+    return 0;
+}
+
+static int async_output_write(void* opaque, const uint8_t* buf, int buf_size) {
+    AsyncOutput* out = (AsyncOutput*)opaque;
+    int done = 0;
+    while (done < buf_size) {
+        int size = FFMIN(buf_size - done, ASYNC_OUTPUT_BUFFER_SIZE);
+        mutex_lock(&out->lock);
+        while (out->count == ASYNC_OUTPUT_BUFFERS && out->error == 0) {
+            cond_wait(&out->cond, &out->lock);
+        }
+        if (out->error < 0) {
+            int ret = out->error;
+            mutex_unlock(&out->lock);
+            return ret;
+        }
+        // д̲߳δύĻ壬ʱس
+        AsyncWrite* w = &out->writes[(out->head + out->count) % ASYNC_OUTPUT_BUFFERS];
+        mutex_unlock(&out->lock);
+        memcpy(w->data, buf + done, size);
+        w->pos = out->pos;
+        w->size = size;
+        mutex_lock(&out->lock);
+        out->count++;
+        cond_broadcast(&out->cond);
+        mutex_unlock(&out->lock);
+        out->pos += size;
+        out->size = FFMAX(out->size, out->pos);
+        done += size;
+    }
+    return buf_size;
+}
+
+static int64_t async_output_seek(void* opaque, int64_t offset, int whence) {
+    AsyncOutput* out = (AsyncOutput*)opaque;
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return out->size;
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += out->pos;
+        break;
+    case SEEK_END:
+        offset += out->size;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (offset < 0) {
+        return AVERROR(EINVAL);
+    }
+    out->pos = offset;
+    return offset;
+}
+
+static void free_async_output(AsyncOutput* out) {
+    for (int i = 0; i < ASYNC_OUTPUT_BUFFERS; i++) {
+        av_free(out->writes[i].data);
+    }
+    av_free(out);
+}
+
+// д߳дoutput_fileAVIOContext
+static int open_async_output(AVIOContext** pb, const char* output_file) {
+    AsyncOutput* out = (AsyncOutput*)av_mallocz(sizeof(AsyncOutput));
+    uint8_t* buffer = (uint8_t*)av_malloc(ASYNC_OUTPUT_BUFFER_SIZE);
+    int ret;
+    if (out == NULL || buffer == NULL) {
+        av_free(out);
+        av_free(buffer);
+        return AVERROR(ENOMEM);
+    }
+    for (int i = 0; i < ASYNC_OUTPUT_BUFFERS; i++) {
+        if ((out->writes[i].data = (uint8_t*)av_malloc(ASYNC_OUTPUT_BUFFER_SIZE)) == NULL) {
+            free_async_output(out);
+            av_free(buffer);
+            return AVERROR(ENOMEM);
+        }
+    }
+    out->fd = fd_open_write(output_file);
+    if (out->fd < 0) {
+        ret = AVERROR(errno);
+        free_async_output(out);
+        av_free(buffer);
+        return ret;
+    }
+    mutex_init(&out->lock);
+    cond_init(&out->cond);
+    if (thread_create(&out->thread, async_output_thread, out) != 0) {
+        ret = AVERROR(EAGAIN);
+        goto fail;
+    }
+    *pb = avio_alloc_context(buffer, ASYNC_OUTPUT_BUFFER_SIZE, 1, out, NULL, async_output_write, async_output_seek);
+    if (*pb == NULL) {
+        mutex_lock(&out->lock);
+        out->stop = 1;
+        cond_broadcast(&out->cond);
+        mutex_unlock(&out->lock);
+        thread_join(out->thread);
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    mem_acquire(*pb);
+    return 0;
+
+fail:
+    mutex_destroy(&out->lock);
+    cond_destroy(&out->cond);
+    fd_close(out->fd);
+    free_async_output(out);
+    av_free(buffer);
+    return ret;
+}
+
+// дʣݣд߳дرдеĴ
+static int close_async_output(AVIOContext** pb) {
+    int ret;
+    if (*pb == NULL) {
+        return 0;
+    }
+    avio_flush(*pb);
+    ret = (*pb)->error;
+    AsyncOutput* out = (AsyncOutput*)(*pb)->opaque;
+    mutex_lock(&out->lock);
+    out->stop = 1;
+    cond_broadcast(&out->cond);
+    mutex_unlock(&out->lock);
+    thread_join(out->thread);
+    if (out->error < 0 && ret >= 0) {
+        ret = out->error;
+    }
+    if (fd_close(out->fd) < 0 && ret >= 0) {
+        ret = AVERROR(errno);
+    }
+    mutex_destroy(&out->lock);
+    cond_destroy(&out->cond);
+    free_async_output(out);
+    av_freep(&(*pb)->buffer);
+    mem_release(*pb);
+    avio_context_free(pb);
+    return ret;
+}
+
+// ---------------- fMP4Ӽϲ ----------------
+// bilibiliaudio.m4s/video.m4sDASHֶMP4ftypmoovsidxmoof+mdat
+// ֱӽЩӣϲmoovΪһ˫moovٰʱ˳
+// moof+mdatдغԭ⸴ú͸á
+
+// һƬmoofһmdat
+typedef struct {
+    int64_t moof_pos;
+    int64_t moof_size;
+    int64_t mdat_pos;
+    int64_t mdat_size;
+    int64_t decode_time;    // tfdtλΪʱ
+} Fmp4Fragment;
+
+// ڴеһ
+typedef struct {
+    uint8_t* data;      // ʼλãͷ
+    int64_t size;       // ܴС
+    int header;         // ͷС816
+} Mp4Box;
+
+#define BOX_BODY(box) ((box)->data + (box)->header)
+#define BOX_BODY_SIZE(box) ((box)->size - (box)->header)
+
+// һļֻһķֶMP4
+typedef struct {
+    AVIOContext* pb;
+    int fd;                     // غɵĴԴ
+    int reflink;                // ݿ
+    uint8_t* ftyp;
+    int64_t ftyp_size;
+    uint8_t* moov;
+    Mp4Box moov_box;
+    uint32_t track_id;
+    uint32_t timescale;         // mdhdеĹʱ
+    uint32_t movie_timescale;   // mvhdеӰƬʱ
+    Fmp4Fragment* fragments;
+    int nb_fragments;
+    int fragments_capacity;
+} Fmp4Input;
+
+#define BOX_MAX_HEADER_SIZE (64 << 20)
+
+// αڴĺӣ*posΪһӵƫƣûиʱ0
+static int next_box(uint8_t* data, int64_t size, int64_t* pos, Mp4Box* box) {
+    if (size - *pos < 8) {
+        return 0;
+    }
+    uint8_t* p = data + *pos;
+    int64_t box_size = AV_RB32(p);
+    int header = 8;
+    if (box_size == 1) {
+        if (size - *pos < 16) {
+            return 0;
+        }
+        box_size = AV_RB64(p + 8);
+        header = 16;
+    }
+    else if (box_size == 0) {
+        box_size = size - *pos;
+    }
+    if (box_size < header || box_size > size - *pos) {
+        return 0;
+    }
+    box->data = p;
+    box->size = box_size;
+    box->header = header;
+    *pos += box_size;
+    return 1;
+}
+
+static uint32_t box_type(const Mp4Box* box) {
+    return AV_RB32(box->data + 4);
+}
+
+// ڸвҵһָ͵Ӻ
+static int find_child_box(const Mp4Box* parent, uint32_t type, Mp4Box* child) {
+    int64_t pos = 0;
+    while (next_box(BOX_BODY(parent), BOX_BODY_SIZE(parent), &pos, child)) {
+        if (box_type(child) == type) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int count_child_boxes(const Mp4Box* parent, uint32_t type) {
+    Mp4Box child;
+    int64_t pos = 0;
+    int count = 0;
+    while (next_box(BOX_BODY(parent), BOX_BODY_SIZE(parent), &pos, &child)) {
+        if (box_type(&child) == type) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// ·ӣ find_box_path(trak, box, "mdia", "mdhd", NULL)
+static int find_box_path(const Mp4Box* parent, Mp4Box* box, ...) {
+    va_list args;
+    const char* name;
+    Mp4Box current = *parent, child;
+    int found = 1;
+    va_start(args, box);
+    while (found && (name = va_arg(args, const char*)) != NULL) {
+        found = find_child_box(&current, MKBETAG(name[0], name[1], name[2], name[3]), &child);
+        current = child;
+    }
+    va_end(args);
+    if (found) {
+        *box = current;
+    }
+    return found;
+}
+
+// ӣfull boxİ汾ţݳȲneedʱ-1
+static int full_box_version(const Mp4Box* box, int64_t need_v0, int64_t need_v1) {
+    if (BOX_BODY_SIZE(box) < 4) {
+        return -1;
+    }
+    int version = BOX_BODY(box)[0];
+    if (BOX_BODY_SIZE(box) < (version == 1 ? need_v1 : need_v0)) {
+        return -1;
+    }
+    return version;
+}
+
+static int box_unsupported(const char* filename, const char* reason) {
+    fprintf(stderr, "治֧ %s: %s\n", filename, reason);
+    return AVERROR_PATCHWELCOME;
+}
+
+// ȡļеһӵڴ
+static int read_box_data(AVIOContext* pb, int64_t pos, int64_t size, uint8_t** data) {
+    if (size > BOX_MAX_HEADER_SIZE) {
+        return AVERROR_PATCHWELCOME;
+    }
+    *data = (uint8_t*)av_malloc(size);
+    if (*data == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    if (avio_seek(pb, pos, SEEK_SET) < 0 || avio_read(pb, *data, (int)size) != size) {
+        av_freep(data);
+        return AVERROR(EIO);
+    }
+    return 0;
+}
+
+// moovֻһδܵĹҪmvex/trex
+static int fmp4_parse_moov(Fmp4Input* in, const char* filename) {
+    Mp4Box mvhd, trak, box;
+    int version;
+
+    if (!find_child_box(&in->moov_box, MKBETAG('m','v','h','d'), &mvhd) ||
+        (version = full_box_version(&mvhd, 100, 112)) < 0) {
+        return box_unsupported(filename, "ȱmvhd");
+    }
+    in->movie_timescale = AV_RB32(BOX_BODY(&mvhd) + (version == 1 ? 20 : 12));
+
+    if (count_child_boxes(&in->moov_box, MKBETAG('t','r','a','k')) != 1 ||
+        !find_child_box(&in->moov_box, MKBETAG('t','r','a','k'), &trak)) {
+        return box_unsupported(filename, "1");
+    }
+    if (count_child_boxes(&in->moov_box, MKBETAG('p','s','s','h')) > 0) {
+        return box_unsupported(filename, "ļѼ");
+    }
+    if (!find_child_box(&trak, MKBETAG('t','k','h','d'), &box) ||
+        (version = full_box_version(&box, 24, 36)) < 0) {
+        return box_unsupported(filename, "ȱtkhd");
+    }
+    in->track_id = AV_RB32(BOX_BODY(&box) + (version == 1 ? 20 : 12));
+
+    if (!find_box_path(&trak, &box, "mdia", "mdhd", NULL) ||
+        (version = full_box_version(&box, 20, 32)) < 0) {
+        return box_unsupported(filename, "ȱmdhd");
+    }
+    in->timescale = AV_RB32(BOX_BODY(&box) + (version == 1 ? 20 : 12));
+    if (in->timescale == 0 || in->movie_timescale == 0) {
+        return box_unsupported(filename, "ʱЧ");
+    }
+
+    if (!find_box_path(&trak, &box, "mdia", "minf", "stbl", "stsd", NULL) ||
+        BOX_BODY_SIZE(&box) < 16) {
+        return box_unsupported(filename, "ȱstsd");
+    }
+    uint32_t entry = AV_RB32(BOX_BODY(&box) + 12);
+    if (entry == MKBETAG('e','n','c','v') || entry == MKBETAG('e','n','c','a')) {
+        return box_unsupported(filename, "ļѼ");
+    }
+
+    if (!find_box_path(&in->moov_box, &box, "mvex", "trex", NULL) ||
+        full_box_version(&box, 8, 8) < 0 || AV_RB32(BOX_BODY(&box) + 4) != in->track_id) {
+        return box_unsupported(filename, "ȱtrex");
+    }
+    return 0;
+}
+
+// moofȡ÷ƬĽʼʱ
+static int fmp4_parse_moof(Fmp4Input* in, const char* filename, uint8_t* data, int64_t size, int64_t* decode_time) {
+    Mp4Box moof, traf, box;
+    int64_t pos = 0;
+    int version;
+
+    if (!next_box(data, size, &pos, &moof)) {
+        return box_unsupported(filename, "moofЧ");
+    }
+    if (count_child_boxes(&moof, MKBETAG('t','r','a','f')) != 1 ||
+        !find_child_box(&moof, MKBETAG('t','r','a','f'), &traf)) {
+        return box_unsupported(filename, "moofеtraf1");
+    }
+    if (!find_child_box(&moof, MKBETAG('m','f','h','d'), &box) || full_box_version(&box, 8, 8) < 0) {
+        return box_unsupported(filename, "ȱmfhd");
+    }
+    if (!find_child_box(&traf, MKBETAG('t','f','h','d'), &box) || full_box_version(&box, 8, 8) < 0 ||
+        AV_RB32(BOX_BODY(&box) + 4) != in->track_id) {
+        return box_unsupported(filename, "tfhdЧ");
+    }
+    if ((AV_RB24(BOX_BODY(&box) + 1) & 0x1) && BOX_BODY_SIZE(&box) < 16) {
+        return box_unsupported(filename, "tfhdЧ");
+    }
+    if (!find_child_box(&traf, MKBETAG('t','f','d','t'), &box) ||
+        (version = full_box_version(&box, 8, 12)) < 0) {
+        return box_unsupported(filename, "ȱtfdt");
+    }
+    *decode_time = version == 1 ? (int64_t)AV_RB64(BOX_BODY(&box) + 4) : AV_RB32(BOX_BODY(&box) + 4);
+    return 0;
+}
+
+static Fmp4Fragment* fmp4_add_fragment(Fmp4Input* in) {
+    if (in->nb_fragments == in->fragments_capacity) {
+        int capacity = in->fragments_capacity ? in->fragments_capacity * 2 : 64;
+        Fmp4Fragment* fragments = (Fmp4Fragment*)av_realloc_array(in->fragments, capacity, sizeof(Fmp4Fragment));
+        if (fragments == NULL) {
+            return NULL;
+        }
+        in->fragments = fragments;
+        in->fragments_capacity = capacity;
+    }
+    Fmp4Fragment* frag = &in->fragments[in->nb_fragments++];
+    memset(frag, 0, sizeof(*frag));
+    return frag;
+}
+
+// ɨļĶӣ¼ftypmoov͸Ƭλ
+static int fmp4_scan_input(Fmp4Input* in, const char* filename) {
+    int64_t file_size = avio_size(in->pb);
+    int64_t pos = 0;
+    int ret;
+
+    if (file_size <= 0) {
+        return box_unsupported(filename, "޷ȡļС");
+    }
+    while (pos < file_size) {
+        if (avio_seek(in->pb, pos, SEEK_SET) < 0) {
+            return AVERROR(EIO);
+        }
+        int64_t size = avio_rb32(in->pb);
+        uint32_t type = avio_rb32(in->pb);
+        int header = 8;
+        if (size == 1) {
+            size = avio_rb64(in->pb);
+            header = 16;
+        }
+        else if (size == 0) {
+            size = file_size - pos;
+        }
+        if (size < header || size > file_size - pos) {
+            return box_unsupported(filename, "ļ");
+        }
+
+        Fmp4Fragment* last = in->nb_fragments ? &in->fragments[in->nb_fragments - 1] : NULL;
+        switch (type) {
+        case MKBETAG('f','t','y','p'):
+            if (in->ftyp == NULL) {
+                if ((ret = read_box_data(in->pb, pos, size, &in->ftyp)) < 0) {
+                    return ret;
+                }
+                in->ftyp_size = size;
+            }
+            break;
+        case MKBETAG('m','o','o','v'):
+            if (in->moov != NULL) {
+                return box_unsupported(filename, "ڶmoov");
+            }
+            if ((ret = read_box_data(in->pb, pos, size, &in->moov)) < 0) {
+                return ret;
+            }
+            in->moov_box.data = in->moov;
+            in->moov_box.size = size;
+            in->moov_box.header = header;
+            if ((ret = fmp4_parse_moov(in, filename)) < 0) {
+                return ret;
+            }
+            break;
+        case MKBETAG('m','o','o','f'): {
+            uint8_t* moof = NULL;
+            int64_t decode_time;
+            if (in->moov == NULL) {
+                return box_unsupported(filename, "moofmoov֮ǰ");
+            }
+            if (last && last->mdat_size == 0) {
+                return box_unsupported(filename, "moofȱmdat");
+            }
+            if ((ret = read_box_data(in->pb, pos, size, &moof)) < 0) {
+                return ret;
+            }
+            ret = fmp4_parse_moof(in, filename, moof, size, &decode_time);
+            av_free(moof);
+            if (ret < 0) {
+                return ret;
+            }
+            if (last && decode_time < last->decode_time) {
+                return box_unsupported(filename, "Ƭʱ䲻ǵ");
+            }
+            Fmp4Fragment* frag = fmp4_add_fragment(in);
+            if (frag == NULL) {
+                return AVERROR(ENOMEM);
+            }
+            frag->moof_pos = pos;
+            frag->moof_size = size;
+            frag->decode_time = decode_time;
+            break;
+        }
+        case MKBETAG('m','d','a','t'):
+            // ʱmoofmdatڣtrunmoofƫƲȻЧ
+            if (last == NULL || last->mdat_size != 0 || last->moof_pos + last->moof_size != pos) {
+                return box_unsupported(filename, "mdatûнmoof֮");
+            }
+            last->mdat_pos = pos;
+            last->mdat_size = size;
+            break;
+        case MKBETAG('s','t','y','p'):
+        case MKBETAG('s','i','d','x'):
+        case MKBETAG('s','s','i','x'):
+        case MKBETAG('e','m','s','g'):
+        case MKBETAG('p','r','f','t'):
+        case MKBETAG('m','f','r','a'):
+        case MKBETAG('f','r','e','e'):
+        case MKBETAG('s','k','i','p'):
+            // ͸ϢвЧֱӶ
+            break;
+        default:
+            return box_unsupported(filename, "δ֪Ķ");
+        }
+        pos += size;
+    }
+    if (in->moov == NULL || in->nb_fragments == 0 || in->fragments[in->nb_fragments - 1].mdat_size == 0) {
+        return box_unsupported(filename, "ǷֶMP4");
+    }
+    return 0;
+}
+
+static int fmp4_open_input(Fmp4Input* in, const char* filename) {
+    return open_file_input(&in->pb, filename);
+}
+
+static void fmp4_close_input(Fmp4Input* in) {
+    av_freep(&in->ftyp);
+    av_freep(&in->moov);
+    av_freep(&in->fragments);
+    close_file_input(&in->pb);
+    if (in->fd >= 0) {
+        fd_close(in->fd);
+        in->fd = -1;
+    }
+}
+
+// дһӵĸͬʱдеĹIDӰƬʱͬʱʱ
+static int write_patched_trak(AVIOContext* out, const Mp4Box* trak, uint32_t track_id,
+                              uint32_t from_timescale, uint32_t to_timescale) {
+    Mp4Box copy = *trak, box;
+    int version;
+
+    copy.data = (uint8_t*)av_memdup(trak->data, trak->size);
+    if (copy.data == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    if (find_child_box(&copy, MKBETAG('t','k','h','d'), &box) && (version = full_box_version(&box, 24, 36)) >= 0) {
+        uint8_t* body = BOX_BODY(&box);
+        AV_WB32(body + (version == 1 ? 20 : 12), track_id);
+        if (from_timescale != to_timescale) {
+            if (version == 1) {
+                AV_WB64(body + 28, av_rescale(AV_RB64(body + 28), to_timescale, from_timescale));
+            }
+            else if (AV_RB32(body + 20) != UINT32_MAX) {
+                AV_WB32(body + 20, (uint32_t)FFMIN(av_rescale(AV_RB32(body + 20), to_timescale, from_timescale), UINT32_MAX - 1));
+            }
+        }
+    }
+    // ༭беķֶʱӰƬʱΪλ
+    if (from_timescale != to_timescale && find_box_path(&copy, &box, "edts", "elst", NULL) &&
+        (version = full_box_version(&box, 8, 8)) >= 0) {
+        uint8_t* body = BOX_BODY(&box);
+        int entry_size = version == 1 ? 20 : 12;
+        uint32_t count = AV_RB32(body + 4);
+        for (uint32_t i = 0; i < count && 8 + (int64_t)(i + 1) * entry_size <= BOX_BODY_SIZE(&box); i++) {
+            uint8_t* p = body + 8 + i * entry_size;
+            if (version == 1) {
+                AV_WB64(p, av_rescale(AV_RB64(p), to_timescale, from_timescale));
+            }
+            else {
+                AV_WB32(p, (uint32_t)FFMIN(av_rescale(AV_RB32(p), to_timescale, from_timescale), UINT32_MAX));
+            }
+        }
+    }
+    avio_write(out, copy.data, (int)copy.size);
+    av_free(copy.data);
+    return 0;
+}
+
+// дtrexĸдID
+static int write_patched_trex(AVIOContext* out, const Fmp4Input* in, uint32_t track_id) {
+    Mp4Box trex;
+    find_box_path(&in->moov_box, &trex, "mvex", "trex", NULL);
+    avio_write(out, trex.data, (int)(BOX_BODY(&trex) - trex.data) + 4);
+    avio_wb32(out, track_id);
+    avio_write(out, BOX_BODY(&trex) + 8, (int)BOX_BODY_SIZE(&trex) - 8);
+    return 0;
+}
+
+// ϲmoovƵIDΪ1ƵIDΪ2Ƶmoov
+static int fmp4_write_moov(AVIOContext* out, Fmp4Input* video, Fmp4Input* audio) {
+    AVIOContext* dyn = NULL;
+    Mp4Box box, mvhd, mehd, video_trak, audio_trak;
+    uint8_t* buf = NULL;
+    int64_t pos = 0;
+    int size, ret;
+
+    if ((ret = avio_open_dyn_buf(&dyn)) < 0) {
+        return ret;
+    }
+    avio_wb32(dyn, 0);
+    avio_wb32(dyn, MKBETAG('m','o','o','v'));
+
+    find_child_box(&video->moov_box, MKBETAG('m','v','h','d'), &mvhd);
+    avio_write(dyn, mvhd.data, (int)mvhd.size - 4);
+    avio_wb32(dyn, 3); // next_track_ID
+
+    find_child_box(&video->moov_box, MKBETAG('t','r','a','k'), &video_trak);
+    find_child_box(&audio->moov_box, MKBETAG('t','r','a','k'), &audio_trak);
+    write_patched_trak(dyn, &video_trak, 1, video->movie_timescale, video->movie_timescale);
+    write_patched_trak(dyn, &audio_trak, 2, audio->movie_timescale, video->movie_timescale);
+
+    // mvexmehdȡнϳʱټtrex
+    int has_mehd = find_box_path(&video->moov_box, &mehd, "mvex", "mehd", NULL) && full_box_version(&mehd, 8, 12) >= 0;
+    Mp4Box video_trex, audio_trex;
+    find_box_path(&video->moov_box, &video_trex, "mvex", "trex", NULL);
+    find_box_path(&audio->moov_box, &audio_trex, "mvex", "trex", NULL);
+    avio_wb32(dyn, (uint32_t)(8 + (has_mehd ? mehd.size : 0) + video_trex.size + audio_trex.size));
+    avio_wb32(dyn, MKBETAG('m','v','e','x'));
+    if (has_mehd) {
+        Mp4Box audio_mehd;
+        int version = BOX_BODY(&mehd)[0];
+        int64_t duration = version == 1 ? (int64_t)AV_RB64(BOX_BODY(&mehd) + 4) : AV_RB32(BOX_BODY(&mehd) + 4);
+        if (find_box_path(&audio->moov_box, &audio_mehd, "mvex", "mehd", NULL) && full_box_version(&audio_mehd, 8, 12) >= 0) {
+            int64_t audio_duration = BOX_BODY(&audio_mehd)[0] == 1 ? (int64_t)AV_RB64(BOX_BODY(&audio_mehd) + 4) : AV_RB32(BOX_BODY(&audio_mehd) + 4);
+            duration = FFMAX(duration, av_rescale(audio_duration, video->movie_timescale, audio->movie_timescale));
+        }
+        avio_write(dyn, mehd.data, (int)(BOX_BODY(&mehd) - mehd.data) + 4);
+        if (version == 1) {
+            avio_wb64(dyn, duration);
+        }
+        else {
+            avio_wb32(dyn, (uint32_t)FFMIN(duration, UINT32_MAX));
+        }
+    }
+    write_patched_trex(dyn, video, 1);
+    write_patched_trex(dyn, audio, 2);
+
+    // ӣudtaȣƵmoov
+    while (next_box(BOX_BODY(&video->moov_box), BOX_BODY_SIZE(&video->moov_box), &pos, &box)) {
+        switch (box_type(&box)) {
+        case MKBETAG('m','v','h','d'):
+        case MKBETAG('t','r','a','k'):
+        case MKBETAG('m','v','e','x'):
+        case MKBETAG('i','o','d','s'):
+            break;
+        default:
+            avio_write(dyn, box.data, (int)box.size);
+            break;
+        }
+    }
+
+    size = avio_close_dyn_buf(dyn, &buf);
+    if (buf == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    AV_WB32(buf, size);
+    avio_write(out, buf, size);
+    av_free(buf);
+    return 0;
+}
+
+// дһƬдmoofеź͹ID󣬽ԭmdat
+static int fmp4_write_fragment(AVIOContext* out, Fmp4Input* in, const Fmp4Fragment* frag,
+                               uint32_t track_id, uint32_t sequence, uint8_t* buf) {
+    Mp4Box moof, traf, box;
+    uint8_t* data = NULL;
+    int64_t pos = 0;
+    int ret;
+
+    // reflinkʱmoofǰfreeӣʹmdatеĿƫͬ
+    // mdatĴ󲿷ݿͿֱӹ
+    if (in->reflink && frag->mdat_size >= REFLINK_MIN_SIZE) {
+        int64_t block_size = ((FileOutput*)out->opaque)->block_size;
+        int64_t pad = ((frag->mdat_pos - avio_tell(out) - frag->moof_size) % block_size + block_size) % block_size;
+        if (pad > 0 && pad < 8) {
+            pad += block_size;
+        }
+        if (pad > 0) {
+            avio_wb32(out, (unsigned int)pad);
+            avio_wb32(out, MKBETAG('f','r','e','e'));
+            for (int64_t i = 8; i < pad; i++) {
+                avio_w8(out, 0);
+            }
+        }
+    }
+
+    if ((ret = read_box_data(in->pb, frag->moof_pos, frag->moof_size, &data)) < 0) {
+        return ret;
+    }
+    next_box(data, frag->moof_size, &pos, &moof);
+    find_child_box(&moof, MKBETAG('m','f','h','d'), &box);
+    AV_WB32(BOX_BODY(&box) + 4, sequence);
+    find_child_box(&moof, MKBETAG('t','r','a','f'), &traf);
+    find_child_box(&traf, MKBETAG('t','f','h','d'), &box);
+    AV_WB32(BOX_BODY(&box) + 4, track_id);
+    // ʽbase_data_offsetļƫƣҪƬλƽ
+    if (AV_RB24(BOX_BODY(&box) + 1) & 0x1) {
+        AV_WB64(BOX_BODY(&box) + 8, AV_RB64(BOX_BODY(&box) + 8) + avio_tell(out) - frag->moof_pos);
+    }
+    avio_write(out, data, (int)frag->moof_size);
+    av_free(data);
+
+    return transfer_payload(out, in->fd, &in->reflink, frag->mdat_pos, frag->mdat_size, buf);
+}
+
+// Ӽϲһ˫ķֶMP4ֻmoovmoofڴ棬
+// mdatͨtransfer_payload()ļ֮䴫䡣ֵ֧ļṹʱ
+// AVERROR_PATCHWELCOME÷Ӧmerge_audio_video()
+int box_merge_audio_video(const char* audio_file, const char* video_file, const char* output_file) {
+    Fmp4Input audio = { 0 }, video = { 0 };
+    AVIOContext* out = NULL;
+    uint8_t* buf = NULL;
+    int v = 0, a = 0;
+    uint32_t sequence = 1;
+    int ret;
+
+    audio.fd = video.fd = -1;
+    int64_t start = stage_begin();
+    if ((ret = fmp4_open_input(&audio, audio_file)) < 0) {
+        fprintf(stderr, "޷Ƶļ\n");
+        goto end;
+    }
+    if ((ret = fmp4_open_input(&video, video_file)) < 0) {
+        fprintf(stderr, "޷Ƶļ\n");
+        goto end;
+    }
+    // 룬ȷܴŴļ
+    if ((ret = fmp4_scan_input(&audio, audio_file)) < 0 ||
+        (ret = fmp4_scan_input(&video, video_file)) < 0) {
+        goto end;
+    }
+    if (video.ftyp == NULL) {
+        ret = box_unsupported(video_file, "ȱftyp");
+        goto end;
+    }
+    stage_end(STAGE_OPEN_INPUT, start);
+
+    audio.fd = fd_open_read(audio_file);
+    video.fd = fd_open_read(video_file);
+    if (audio.fd < 0 || video.fd < 0) {
+        ret = AVERROR(errno);
+        fprintf(stderr, "޷ļ\n");
+        goto end;
+    }
+    buf = (uint8_t*)av_malloc(COPY_BUFFER_SIZE);
+    if (buf == NULL) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = open_file_output(&out, output_file)) < 0) {
+        fprintf(stderr, "޷ļ\n");
+        goto end;
+    }
+    audio.reflink = reflink_possible(audio.fd, out);
+    video.reflink = reflink_possible(video.fd, out);
+    start = stage_begin();
+    avio_write(out, video.ftyp, (int)video.ftyp_size);
+    if ((ret = fmp4_write_moov(out, &video, &audio)) < 0) {
+        goto end;
+    }
+
+    // ʱ佻дķƬʱͬʱƵǰ
+    while (v < video.nb_fragments || a < audio.nb_fragments) {
+        int use_video = a >= audio.nb_fragments ||
+            (v < video.nb_fragments &&
+             av_compare_ts(video.fragments[v].decode_time, (AVRational){ 1, (int)video.timescale },
+                           audio.fragments[a].decode_time, (AVRational){ 1, (int)audio.timescale }) <= 0);
+        if (use_video) {
+            ret = fmp4_write_fragment(out, &video, &video.fragments[v++], 1, sequence++, buf);
+        }
+        else {
+            ret = fmp4_write_fragment(out, &audio, &audio.fragments[a++], 2, sequence++, buf);
+        }
+        if (ret < 0) {
+            fprintf(stderr, "дƬʧܡ\n");
+            goto end;
+        }
+    }
+    stage_end(STAGE_COPY, start);
+
+end:
+    if (out) {
+        start = stage_begin();
+        int close_ret = close_file_output(&out);
+        stage_end(STAGE_TRAILER, start);
+        if (ret >= 0) {
+            ret = close_ret;
+        }
+    }
+    av_free(buf);
+    fmp4_close_input(&audio);
+    fmp4_close_input(&video);
+    return ret;
+}
+
+
+// Ƭеһ
+typedef struct {
+    int64_t dts;            // ʱ
+    uint32_t duration;
+    uint32_t size;
+    int32_t cts_offset;
+    int keyframe;
+} Fmp4Sample;
+
+static Fmp4Sample* fmp4_add_sample(Fmp4Sample** samples, int* nb_samples, int* capacity) {
+    if (*nb_samples == *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 1024;
+        Fmp4Sample* tmp = (Fmp4Sample*)av_realloc_array(*samples, new_capacity, sizeof(Fmp4Sample));
+        if (tmp == NULL) {
+            return NULL;
+        }
+        *samples = tmp;
+        *capacity = new_capacity;
+    }
+    return &(*samples)[(*nb_samples)++];
+}
+
+// һmoofеtrun׷Ϣ
+static int fmp4_parse_samples(Fmp4Input* in, uint8_t* data, int64_t size,
+                              Fmp4Sample** samples, int* nb_samples, int* capacity) {
+    Mp4Box moof, traf, tfhd, tfdt, trex, trun;
+    int64_t pos = 0, dts;
+    uint32_t default_duration, default_size, default_flags;
+
+    if (!next_box(data, size, &pos, &moof) || !find_child_box(&moof, MKBETAG('t','r','a','f'), &traf) ||
+        !find_child_box(&traf, MKBETAG('t','f','h','d'), &tfhd) || !find_child_box(&traf, MKBETAG('t','f','d','t'), &tfdt) ||
+        !find_box_path(&in->moov_box, &trex, "mvex", "trex", NULL) || BOX_BODY_SIZE(&trex) < 24) {
+        return AVERROR_PATCHWELCOME;
+    }
+    dts = BOX_BODY(&tfdt)[0] == 1 ? (int64_t)AV_RB64(BOX_BODY(&tfdt) + 4) : AV_RB32(BOX_BODY(&tfdt) + 4);
+    default_duration = AV_RB32(BOX_BODY(&trex) + 12);
+    default_size = AV_RB32(BOX_BODY(&trex) + 16);
+    default_flags = AV_RB32(BOX_BODY(&trex) + 20);
+
+    // tfhdеĿѡֶγ֣trexеĬֵ
+    uint32_t tf_flags = AV_RB24(BOX_BODY(&tfhd) + 1);
+    uint8_t* p = BOX_BODY(&tfhd) + 8;
+    uint8_t* end = BOX_BODY(&tfhd) + BOX_BODY_SIZE(&tfhd);
+    p += (tf_flags & 0x1) ? 8 : 0;
+    p += (tf_flags & 0x2) ? 4 : 0;
+    if (tf_flags & 0x8) {
+        if (end - p < 4) return AVERROR_PATCHWELCOME;
+        default_duration = AV_RB32(p);
+        p += 4;
+    }
+    if (tf_flags & 0x10) {
+        if (end - p < 4) return AVERROR_PATCHWELCOME;
+        default_size = AV_RB32(p);
+        p += 4;
+    }
+    if (tf_flags & 0x20) {
+        if (end - p < 4) return AVERROR_PATCHWELCOME;
+        default_flags = AV_RB32(p);
+        p += 4;
+    }
+
+    pos = 0;
+    while (next_box(BOX_BODY(&traf), BOX_BODY_SIZE(&traf), &pos, &trun)) {
+        if (box_type(&trun) != MKBETAG('t','r','u','n')) {
+            continue;
+        }
+        if (BOX_BODY_SIZE(&trun) < 8) {
+            return AVERROR_PATCHWELCOME;
+        }
+        int version = BOX_BODY(&trun)[0];
+        uint32_t flags = AV_RB24(BOX_BODY(&trun) + 1);
+        uint32_t count = AV_RB32(BOX_BODY(&trun) + 4);
+        uint32_t first_flags = default_flags;
+        int first_flags_present = 0;
+        int entry_size = 4 * (!!(flags & 0x100) + !!(flags & 0x200) + !!(flags & 0x400) + !!(flags & 0x800));
+        p = BOX_BODY(&trun) + 8;
+        end = BOX_BODY(&trun) + BOX_BODY_SIZE(&trun);
+        p += (flags & 0x1) ? 4 : 0;
+        if (flags & 0x4) {
+            if (end - p < 4) return AVERROR_PATCHWELCOME;
+            first_flags = AV_RB32(p);
+            first_flags_present = 1;
+            p += 4;
+        }
+        if (end - p < (int64_t)count * entry_size) {
+            return AVERROR_PATCHWELCOME;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            Fmp4Sample* sample = fmp4_add_sample(samples, nb_samples, capacity);
+            uint32_t sample_flags = default_flags;
+            if (sample == NULL) {
+                return AVERROR(ENOMEM);
+            }
+            sample->dts = dts;
+            sample->duration = default_duration;
+            sample->size = default_size;
+            sample->cts_offset = 0;
+            if (flags & 0x100) {
+                sample->duration = AV_RB32(p);
+                p += 4;
+            }
+            if (flags & 0x200) {
+                sample->size = AV_RB32(p);
+                p += 4;
+            }
+            if (flags & 0x400) {
+                sample_flags = AV_RB32(p);
+                p += 4;
+            }
+            else if (i == 0 && first_flags_present) {
+                sample_flags = first_flags;
+            }
+            if (flags & 0x800) {
+                sample->cts_offset = version == 1 ? (int32_t)AV_RB32(p) : (int32_t)FFMIN(AV_RB32(p), INT32_MAX);
+                p += 4;
+            }
+            // sample_is_non_sync_sample
+            sample->keyframe = !(sample_flags & 0x10000);
+            dts += sample->duration;
+        }
+    }
+    return 0;
+}
+
+// ȡʱ䡢С͹ؼ֡Ϣֻmoofmdat
+static int fmp4_load_samples(const char* filename, Fmp4Sample** samples, int* nb_samples, uint32_t* timescale) {
+    Fmp4Input in = { 0 };
+    int capacity = 0;
+    int ret;
+
+    in.fd = -1;
+    *samples = NULL;
+    *nb_samples = 0;
+    if ((ret = fmp4_open_input(&in, filename)) < 0 ||
+        (ret = fmp4_scan_input(&in, filename)) < 0) {
+        goto end;
+    }
+    *timescale = in.timescale;
+    for (int i = 0; i < in.nb_fragments; i++) {
+        uint8_t* data = NULL;
+        if ((ret = read_box_data(in.pb, in.fragments[i].moof_pos, in.fragments[i].moof_size, &data)) < 0) {
+            goto end;
+        }
+        ret = fmp4_parse_samples(&in, data, in.fragments[i].moof_size, samples, nb_samples, &capacity);
+        av_free(data);
+        if (ret < 0) {
+            goto end;
+        }
+    }
+
+end:
+    fmp4_close_input(&in);
+    if (ret < 0) {
+        av_freep(samples);
+        *nb_samples = 0;
+    }
+    return ret;
+}
+
+// ΪһѡõʱmovĹһ
+static int mov_track_timescale(const AVStream* st) {
+    if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && st->codecpar->sample_rate > 0) {
+        return st->codecpar->sample_rate;
+    }
+    int timescale = st->time_base.den;
+    while (timescale < 10000) {
+        timescale *= 2;
+    }
+    return timescale;
+}
+
+// ԤһmoovռõĴСֿʱ任㵽ʱ
+static int64_t estimate_track_size(const AVStream* st, Fmp4Sample* samples, int nb_samples, uint32_t timescale) {
+    int out_timescale = mov_track_timescale(st);
+    // ʱʱʱԾȷ㣬ܰγ̼stts/cttsĿ
+    // ÿռһĿ
+    int exact = out_timescale % (int)timescale == 0;
+    int64_t stts = 0, ctts = 0, keyframes = 0, prev_duration = -1, prev_cts = INT64_MIN;
+    int has_ctts = 0;
+
+    for (int i = 0; i < nb_samples; i++) {
+        AVRational in_tb = { 1, (int)timescale }, out_tb = { 1, out_timescale };
+        int64_t dts = av_rescale_q(samples[i].dts, in_tb, out_tb);
+        int64_t next = i + 1 < nb_samples ? av_rescale_q(samples[i + 1].dts, in_tb, out_tb)
+                                          : dts + av_rescale_q(samples[i].duration, in_tb, out_tb);
+        int64_t cts = av_rescale_q(samples[i].dts + samples[i].cts_offset, in_tb, out_tb) - dts;
+        if (next - dts != prev_duration) {
+            stts++;
+            prev_duration = next - dts;
+        }
+        if (cts != prev_cts) {
+            ctts++;
+            prev_cts = cts;
+        }
+        has_ctts |= cts != 0;
+        keyframes += samples[i].keyframe;
+        samples[i].dts = dts;
+    }
+    if (!exact) {
+        stts = ctts = nb_samples;
+    }
+
+    int64_t size = 2048 + 2 * (int64_t)st->codecpar->extradata_size;
+    size += 20 + 4 * (int64_t)nb_samples;                        // stsz
+    size += 16 + 8 * (stts + 2);                                 // stts
+    size += has_ctts ? 16 + 8 * (ctts + 2) : 0;                  // ctts
+    size += keyframes < nb_samples ? 16 + 4 * keyframes : 0;     // stss
+    size += st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO ? 12 + (int64_t)nb_samples : 0; // sdtp
+    return size;
+}
+
+// ԤmoovСޣڵдfaststartϢmoof
+// DTS˳ģ⸴ķֿ飨ͬһҲ1MBΪһ飩
+// ޷Ԥʱظֵ
+static int64_t estimate_moov_size(const char* audio_file, const char* video_file,
+                                  const AVStream* out_audio_stream, const AVStream* out_video_stream) {
+    Fmp4Sample* samples[2] = { NULL, NULL };
+    int nb_samples[2] = { 0, 0 };
+    uint32_t timescale[2];
+    const AVStream* streams[2] = { out_audio_stream, out_video_stream };
+    int64_t size = -1;
+
+    if (fmp4_load_samples(audio_file, &samples[0], &nb_samples[0], &timescale[0]) < 0 ||
+        fmp4_load_samples(video_file, &samples[1], &nb_samples[1], &timescale[1]) < 0 ||
+        nb_samples[0] == 0 || nb_samples[1] == 0) {
+        goto end;
+    }
+
+    size = 4096;
+    for (int t = 0; t < 2; t++) {
+        size += estimate_track_size(streams[t], samples[t], nb_samples[t], timescale[t]);
+    }
+
+    // ģֿ
+    int64_t chunks[2] = { 0, 0 }, stsc[2] = { 0, 0 }, chunk_size = 0, total = 0;
+    int idx[2] = { 0, 0 }, last = -1, per_chunk = 0, prev_per_chunk[2] = { -1, -1 };
+    AVRational tb[2] = { { 1, mov_track_timescale(streams[0]) }, { 1, mov_track_timescale(streams[1]) } };
+    while (idx[0] < nb_samples[0] || idx[1] < nb_samples[1]) {
+        int t = idx[1] >= nb_samples[1] ||
+            (idx[0] < nb_samples[0] && av_compare_ts(samples[0][idx[0]].dts, tb[0], samples[1][idx[1]].dts, tb[1]) <= 0) ? 0 : 1;
+        uint32_t sample_size = samples[t][idx[t]++].size;
+        if (t == last && chunk_size + sample_size < (1 << 20)) {
+            chunk_size += sample_size;
+            per_chunk++;
+        }
+        else {
+            if (last >= 0 && per_chunk != prev_per_chunk[last]) {
+                stsc[last]++;
+                prev_per_chunk[last] = per_chunk;
+            }
+            chunks[t]++;
+            chunk_size = sample_size;
+            per_chunk = 1;
+            last = t;
+        }
+        total += sample_size;
+    }
+    stsc[last]++;
+    for (int t = 0; t < 2; t++) {
+        // ˳븴гʱ仯
+        int64_t chunk_bound = FFMIN(nb_samples[t], chunks[t] + chunks[t] / 4 + 64);
+        int64_t stsc_bound = FFMIN(chunk_bound, stsc[t] + stsc[t] / 4 + 64);
+        size += 16 + chunk_bound * (total > UINT32_MAX ? 8 : 4);   // stco/co64
+        size += 16 + stsc_bound * 12;                               // stsc
+    }
+    size += size / 32;
+
+end:
+    av_free(samples[0]);
+    av_free(samples[1]);
+    return size;
+}
+
+void format_filename(char* filename) {
+    char* src = filename, * dst = filename;
+    while (*src) {
+        // ֻĸ֡»ߺַ
+        if (isalnum((unsigned char)*src) || *src == '_' || (*src & 0x80)) {
+            *dst++ = *src;
+        }
+        src++;
+    }
+    *dst = '\0';
+}
+
+// 缯嵥¼ÿ缯ļǩٴʱûб仯ľ缯
+// 嵥Ŀ¼Уһֻ׷ӵĶ־ͬһ缯һ¼Ϊ׼
+// ÿһ׷һ;˳Ҳᶪʧɵļ¼
+#define MANIFEST_PATH "videotrans/bv2video.manifest"
+#define MANIFEST_MAGIC "BV2VMAN1"
+#define MANIFEST_RECORD_HEADER_SIZE 56
+
+enum {
+    MANIFEST_DONE = 1,
+    MANIFEST_FAILED,
+};
+
+// entry.jsonaudio.m4svideo.m4sĴС޸ʱ
+typedef struct {
+    int64_t size[3];
+    int64_t mtime[3];
+} EpisodeSignature;
+
+typedef struct {
+    char* episode;  // 缯Ŀ¼Ϊ
+    char* typeTag;
+    char* output;
+    EpisodeSignature sig;
+    int status;
+} ManifestEntry;
+
+typedef struct {
+    ManifestEntry** slots;
+    int size;
+    int capacity;
+    int records;    // ־еļ¼Զھ缯ʱڹرʱѹ
+    FILE* journal;
+    char* path;
+    mutex_t lock;
+} Manifest;
+
+// ȡ缯ļǩһļʱ-1
+static int getEpisodeSignature(const char* episodeDir, const char* typeTag, EpisodeSignature* sig) {
+    static const char* const names[3] = { "entry.json", "audio.m4s", "video.m4s" };
+    for (int i = 0; i < 3; i++) {
+        char path[1024];
+        struct stat statbuf;
+        if (i == 0) {
+            snprintf(path, sizeof(path), "%s/%s", episodeDir, names[i]);
+        }
+        else {
+            snprintf(path, sizeof(path), "%s/%s/%s", episodeDir, typeTag, names[i]);
+        }
+        if (stat(path, &statbuf) != 0) {
+            return -1;
+        }
+        sig->size[i] = statbuf.st_size;
+        sig->mtime[i] = statbuf.st_mtime;
+    }
+    return 0;
+}
+
+static ManifestEntry** manifest_slot(Manifest* manifest, const char* episode) {
+    unsigned int i = hash_string(episode) & (manifest->capacity - 1);
+    while (manifest->slots[i] && strcmp(manifest->slots[i]->episode, episode) != 0) {
+        i = (i + 1) & (manifest->capacity - 1);
+    }
+    return &manifest->slots[i];
+}
+
+// 滻缯¼ɹʱ0
+static int manifest_put(Manifest* manifest, const char* episode, const char* typeTag, const char* output,
+                        const EpisodeSignature* sig, int status) {
+    if ((manifest->size + 1) * 2 > manifest->capacity) {
+        ManifestEntry** old_slots = manifest->slots;
+        int old_capacity = manifest->capacity;
+        int cap = old_capacity ? old_capacity * 2 : 64;
+        manifest->slots = (ManifestEntry**)calloc(cap, sizeof(ManifestEntry*));
+        if (manifest->slots == NULL) {
+            manifest->slots = old_slots;
+            return -1;
+        }
+        manifest->capacity = cap;
+        for (int i = 0; i < old_capacity; i++) {
+            if (old_slots[i]) {
+                *manifest_slot(manifest, old_slots[i]->episode) = old_slots[i];
+            }
+        }
+        free(old_slots);
+    }
+
+    ManifestEntry** slot = manifest_slot(manifest, episode);
+    ManifestEntry* entry = *slot;
+    if (entry == NULL) {
+        entry = (ManifestEntry*)calloc(1, sizeof(ManifestEntry));
+        if (entry == NULL || (entry->episode = _strdup(episode)) == NULL) {
+            free(entry);
+            return -1;
+        }
+        *slot = entry;
+        manifest->size++;
+    }
+    free(entry->typeTag);
+    free(entry->output);
+    entry->typeTag = _strdup(typeTag);
+    entry->output = _strdup(output);
+    entry->sig = *sig;
+    entry->status = status;
+    return entry->typeTag && entry->output ? 0 : -1;
+}
+
+static int manifest_write_record(FILE* file, const ManifestEntry* entry) {
+    uint8_t header[MANIFEST_RECORD_HEADER_SIZE];
+    size_t episode_len = strlen(entry->episode), type_len = strlen(entry->typeTag), output_len = strlen(entry->output);
+    if (episode_len >= 1024 || type_len >= 1024 || output_len >= 1024) {
+        return -1;
+    }
+    AV_WL16(header, episode_len);
+    AV_WL16(header + 2, type_len);
+    AV_WL16(header + 4, output_len);
+    header[6] = entry->status;
+    header[7] = 0;
+    for (int i = 0; i < 3; i++) {
+        AV_WL64(header + 8 + i * 16, entry->sig.size[i]);
+        AV_WL64(header + 16 + i * 16, entry->sig.mtime[i]);
+    }
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header) ||
+        fwrite(entry->episode, 1, episode_len, file) != episode_len ||
+        fwrite(entry->typeTag, 1, type_len, file) != type_len ||
+        fwrite(entry->output, 1, output_len, file) != output_len) {
+        return -1;
+    }
+    return 0;
+}
+
+// ־еȫ¼ֵΪ0ʾ־1ʾĩβвȱļ¼
+static int manifest_load(Manifest* manifest, FILE* file) {
+    char magic[sizeof(MANIFEST_MAGIC) - 1];
+    uint8_t header[MANIFEST_RECORD_HEADER_SIZE];
+    char buf[3][1024];
+
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, MANIFEST_MAGIC, sizeof(magic)) != 0) {
+        return 1;
+    }
+    while (fread(header, 1, sizeof(header), file) == sizeof(header)) {
+        EpisodeSignature sig;
+        int len[3] = { AV_RL16(header), AV_RL16(header + 2), AV_RL16(header + 4) };
+        for (int i = 0; i < 3; i++) {
+            if (len[i] >= (int)sizeof(buf[i]) || fread(buf[i], 1, len[i], file) != (size_t)len[i]) {
+                return 1;
+            }
+            buf[i][len[i]] = '\0';
+        }
+        for (int i = 0; i < 3; i++) {
+            sig.size[i] = AV_RL64(header + 8 + i * 16);
+            sig.mtime[i] = AV_RL64(header + 16 + i * 16);
+        }
+        if (manifest_put(manifest, buf[0], buf[1], buf[2], &sig, header[6]) < 0) {
+            return 1;
+        }
+        manifest->records++;
+    }
+    return feof(file) ? 0 : 1;
+}
+
+// ֻÿ缯¼¼дʱļ滻ԭ־
+static int manifest_compact(Manifest* manifest) {
+    char tmpPath[1024];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", manifest->path);
+    FILE* file = fopen(tmpPath, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    int ret = fwrite(MANIFEST_MAGIC, 1, sizeof(MANIFEST_MAGIC) - 1, file) == sizeof(MANIFEST_MAGIC) - 1 ? 0 : -1;
+    for (int i = 0; i < manifest->capacity && ret == 0; i++) {
+        if (manifest->slots[i]) {
+            ret = manifest_write_record(file, manifest->slots[i]);
+        }
+    }
+    if (fclose(file) != 0 || ret < 0) {
+        remove(tmpPath);
+        return -1;
+    }
+#ifdef _WIN32
+    remove(manifest->path);
+#endif
+    if (rename(tmpPath, manifest->path) != 0) {
+        remove(tmpPath);
+        return -1;
+    }
+    manifest->records = manifest->size;
+    return 0;
+}
+
+// ر嵥¼Զھ缯ʱѹ־
+void closeManifest(Manifest* manifest) {
+    if (manifest->journal) {
+        fclose(manifest->journal);
+        if (manifest->records > manifest->size * 2 && manifest_compact(manifest) < 0) {
+            fprintf(stderr, "ѹ嵥ʧ: %s\n", manifest->path);
+        }
+    }
+    for (int i = 0; i < manifest->capacity; i++) {
+        if (manifest->slots[i]) {
+            free(manifest->slots[i]->episode);
+            free(manifest->slots[i]->typeTag);
+            free(manifest->slots[i]->output);
+            free(manifest->slots[i]);
+        }
+    }
+    free(manifest->slots);
+    mutex_destroy(&manifest->lock);
+    free(manifest->path);
+    free(manifest);
+}
+
+// 嵥ʱ½ʧʱNULLʱת
+Manifest* openManifest(const char* path) {
+    Manifest* manifest = (Manifest*)calloc(1, sizeof(Manifest));
+    if (manifest == NULL || (manifest->path = _strdup(path)) == NULL) {
+        free(manifest);
+        return NULL;
+    }
+    mutex_init(&manifest->lock);
+    manifest->slots = (ManifestEntry**)calloc(64, sizeof(ManifestEntry*));
+    if (manifest->slots == NULL) {
+        closeManifest(manifest);
+        return NULL;
+    }
+    manifest->capacity = 64;
+
+    FILE* file = fopen(path, "rb");
+    int damaged = 0;
+    if (file) {
+        damaged = manifest_load(manifest, file);
+        fclose(file);
+    }
+    // ½嵥ĩβȱϴдʱжϣ־дһ飬׷ӷʽ
+    if ((file == NULL || damaged) && manifest_compact(manifest) < 0) {
+        fprintf(stderr, "޷д嵥 %sβת\n", path);
+        closeManifest(manifest);
+        return NULL;
+    }
+    manifest->journal = fopen(path, "ab");
+    if (manifest->journal == NULL) {
+        fprintf(stderr, "޷д嵥 %sβת\n", path);
+        closeManifest(manifest);
+        return NULL;
+    }
+    printf("嵥 %d 缯\n", manifest->size);
+    return manifest;
+}
+
+// Ҿ缯ļļûб仯ʱ1
+// ֻҪ嵥иþ缯ͨoutputϴʹõļ
+int lookupManifest(Manifest* manifest, const char* episode, char* output, size_t size) {
+    EpisodeSignature recorded, current;
+    char typeTag[MAX_NAME_LEN];
+    int status;
+    struct stat statbuf;
+
+    mutex_lock(&manifest->lock);
+    ManifestEntry* entry = *manifest_slot(manifest, episode);
+    if (entry) {
+        snprintf(output, size, "%s", entry->output);
+        snprintf(typeTag, sizeof(typeTag), "%s", entry->typeTag);
+        recorded = entry->sig;
+        status = entry->status;
+    }
+    mutex_unlock(&manifest->lock);
+
+    if (entry == NULL) {
+        output[0] = '\0';
+        return 0;
+    }
+    return status == MANIFEST_DONE &&
+        getEpisodeSignature(episode, typeTag, &current) == 0 &&
+        memcmp(&current, &recorded, sizeof(current)) == 0 &&
+        stat(output, &statbuf) == 0;
+}
+
+// ¼׷ӵ־
+void updateManifest(Manifest* manifest, const char* episode, const char* typeTag, const char* output,
+                    const EpisodeSignature* sig, int status) {
+    mutex_lock(&manifest->lock);
+    if (manifest_put(manifest, episode, typeTag, output, sig, status) < 0 ||
+        manifest_write_record(manifest->journal, *manifest_slot(manifest, episode)) < 0 ||
+        fflush(manifest->journal) != 0) {
+        fprintf(stderr, "д嵥ʧ: %s\n", episode);
+    }
+    manifest->records++;
+    mutex_unlock(&manifest->lock);
+}
+
+// 嵥еļȫǼΪռã¾缯ǰ
+void reserveManifestOutputs(Manifest* manifest, NameSet* names) {
+    for (int i = 0; i < manifest->capacity; i++) {
+        if (manifest->slots[i]) {
+            addNameToSet(names, manifest->slots[i]->output);
+        }
+    }
+}
+
+// ϲÿ缯entry.jsonaudio.m4svideo.m4sӦһ
+typedef struct {
+    char audioFile[1024];
+    char videoFile[1024];
+    char outputFile[1024];
+    char episodeDir[1024];
+    char typeTag[MAX_NAME_LEN];
+    EpisodeSignature sig;   // ʱǩɺд嵥
+    struct DedupGroup* dedup;   // ͬľ缯飬ȥʱΪNULL
+    int dedupPrimary;           // ǷΪڵһϲģ
+    int64_t prefetched;         // ʱԤ߳ȡʱԤй黹
+} MergeJob;
+
+// ȥأͬһƵڶĿ¼СļĴСɲ
+// ʼΡм伸ͽβָƣָͬľ缯ֻϲһΣ
+// 缯ͨreflinkӲָһκϲĽ
+#define DEDUP_SAMPLE_SIZE (64 << 10)
+#define DEDUP_NB_SAMPLES 5
+#define DEDUP_HASH_SIZE 16
+
+enum {
+    DEDUP_PENDING,
+    DEDUP_DONE,
+    DEDUP_FAILED,
+};
+
+typedef struct {
+    int64_t size[2];
+    uint8_t hash[DEDUP_HASH_SIZE];
+} ContentFingerprint;
+
+// ͬһ缯һ缯ϲ缯ǰ
+// ﹤߳ʱݴwaitingУĹ̴߳
+typedef struct DedupGroup {
+    ContentFingerprint key;
+    char output[1024];      // ļ
+    int state;
+    MergeJob** waiting;
+    int nb_waiting;
+    int waiting_capacity;
+    mutex_t lock;
+} DedupGroup;
+
+// ָƵ缯Ĺϣֻڽ߳з
+typedef struct {
+    DedupGroup** slots;
+    int size;
+    int capacity;
+    struct AVHashContext* hash;
+    uint8_t* buf;
+} DedupTable;
+
+// ļĲϣ
+static int hash_file_samples(struct AVHashContext* hash, const char* filename, int64_t* size, uint8_t* buf) {
+    int fd = fd_open_read(filename);
+    if (fd < 0) {
+        return AVERROR(errno);
+    }
+    int ret = 0;
+    *size = fd_seek(fd, 0, SEEK_END);
+    if (*size < 0) {
+        ret = AVERROR(errno);
+    }
+    for (int i = 0; i < DEDUP_NB_SAMPLES && ret == 0; i++) {
+        int64_t pos = FFMAX(0, (*size - DEDUP_SAMPLE_SIZE) * i / (DEDUP_NB_SAMPLES - 1));
+        int len = (int)FFMIN(DEDUP_SAMPLE_SIZE, *size - pos), got = 0;
+        if (fd_seek(fd, pos, SEEK_SET) < 0) {
+            ret = AVERROR(errno);
+            break;
+        }
+        while (got < len) {
+            int n = (int)fd_read(fd, buf + got, len - got);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                ret = n < 0 ? AVERROR(errno) : AVERROR(EIO);
+                break;
+            }
+            got += n;
+        }
+        av_hash_update(hash, buf, got);
+    }
+    fd_close(fd);
+    return ret;
+}
+
+static int computeFingerprint(DedupTable* table, const MergeJob* job, ContentFingerprint* fp) {
+    int ret;
+    memset(fp, 0, sizeof(*fp));
+    av_hash_init(table->hash);
+    if ((ret = hash_file_samples(table->hash, job->audioFile, &fp->size[0], table->buf)) < 0 ||
+        (ret = hash_file_samples(table->hash, job->videoFile, &fp->size[1], table->buf)) < 0) {
+        return ret;
+    }
+    av_hash_final(table->hash, fp->hash);
+    return 0;
+}
+
+DedupTable* createDedupTable(void) {
+    DedupTable* table = (DedupTable*)calloc(1, sizeof(DedupTable));
+    if (table == NULL) {
+        return NULL;
+    }
+    table->capacity = 64;
+    table->slots = (DedupGroup**)calloc(table->capacity, sizeof(DedupGroup*));
+    table->buf = (uint8_t*)av_malloc(DEDUP_SAMPLE_SIZE);
+    if (table->slots == NULL || table->buf == NULL || av_hash_alloc(&table->hash, "murmur3") < 0 ||
+        av_hash_get_size(table->hash) > DEDUP_HASH_SIZE) {
+        av_hash_freep(&table->hash);
+        av_free(table->buf);
+        free(table->slots);
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+static DedupGroup** dedup_slot(DedupTable* table, const ContentFingerprint* fp) {
+    unsigned int i = AV_RN32(fp->hash) & (table->capacity - 1);
+    while (table->slots[i] && memcmp(&table->slots[i]->key, fp, sizeof(*fp)) != 0) {
+        i = (i + 1) & (table->capacity - 1);
+    }
+    return &table->slots[i];
+}
+
+// Ϊͬľ缯飬ҲʱԸΪ½һ顣
+// ָʧʱ񲻲ȥ
+void assignDedupGroup(DedupTable* table, MergeJob* job) {
+    ContentFingerprint fp;
+    job->dedup = NULL;
+    job->dedupPrimary = 0;
+    if (computeFingerprint(table, job, &fp) < 0) {
+        return;
+    }
+    if ((table->size + 1) * 2 > table->capacity) {
+        DedupGroup** old_slots = table->slots;
+        int old_capacity = table->capacity;
+        DedupGroup** slots = (DedupGroup**)calloc(old_capacity * 2, sizeof(DedupGroup*));
+        if (slots == NULL) {
+            return;
+        }
+        table->slots = slots;
+        table->capacity = old_capacity * 2;
+        for (int i = 0; i < old_capacity; i++) {
+            if (old_slots[i]) {
+                *dedup_slot(table, &old_slots[i]->key) = old_slots[i];
+            }
+        }
+        free(old_slots);
+    }
+    DedupGroup** slot = dedup_slot(table, &fp);
+    if (*slot) {
+        job->dedup = *slot;
+        printf(" %s ͬ\n", (*slot)->output);
+        return;
+    }
+    DedupGroup* group = (DedupGroup*)calloc(1, sizeof(DedupGroup));
+    if (group == NULL) {
+        return;
+    }
+    group->key = fp;
+    group->state = DEDUP_PENDING;
+    snprintf(group->output, sizeof(group->output), "%s", job->outputFile);
+    mutex_init(&group->lock);
+    *slot = group;
+    table->size++;
+    job->dedup = group;
+    job->dedupPrimary = 1;
+}
+
+// ͷȥرʱй̶߳ѽ
+void freeDedupTable(DedupTable* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        DedupGroup* group = table->slots[i];
+        if (group) {
+            mutex_destroy(&group->lock);
+            free(group->waiting);
+            free(group);
+        }
+    }
+    free(table->slots);
+    av_hash_freep(&table->hash);
+    av_free(table->buf);
+    free(table);
+}
+
+// ݴûɵظнʱ0÷д
+static int dedup_wait(DedupGroup* group, MergeJob* job, int* state) {
+    int queued = 0;
+    mutex_lock(&group->lock);
+    *state = group->state;
+    if (group->state == DEDUP_PENDING) {
+        if (group->nb_waiting == group->waiting_capacity) {
+            int capacity = group->waiting_capacity ? group->waiting_capacity * 2 : 4;
+            MergeJob** tmp = (MergeJob**)realloc(group->waiting, capacity * sizeof(MergeJob*));
+            if (tmp) {
+                group->waiting = tmp;
+                group->waiting_capacity = capacity;
+            }
+        }
+        if (group->nb_waiting < group->waiting_capacity) {
+            group->waiting[group->nb_waiting++] = job;
+            queued = 1;
+        }
+    }
+    mutex_unlock(&group->lock);
+    return queued;
+}
+
+// ¼Ľȡȴеظ
+static MergeJob** dedup_complete(DedupGroup* group, int state, int* nb_waiting) {
+    mutex_lock(&group->lock);
+    MergeJob** waiting = group->waiting;
+    *nb_waiting = group->nb_waiting;
+    group->state = state;
+    group->waiting = NULL;
+    group->nb_waiting = group->waiting_capacity = 0;
+    mutex_unlock(&group->lock);
+    return waiting;
+}
+
+// dstΪsrcĸreflinkӲӣʱļ
+static int linkOutputFile(const char* src, const char* dst) {
+    // ģʽתľ缯ԭļڵһκϲͬ
+    // ʱɾdstsrcWindowsļִСд
+#ifdef _WIN32
+    if (_stricmp(src, dst) == 0) {
+        return 0;
+    }
+#else
+    if (strcmp(src, dst) == 0) {
+        return 0;
+    }
+#endif
+    remove(dst);
+#ifdef _WIN32
+    if (CreateHardLinkA(dst, src, NULL) || CopyFileA(src, dst, FALSE)) {
+        return 0;
+    }
+    return AVERROR(EIO);
+#else
+    int in_fd = fd_open_read(src);
+    if (in_fd < 0) {
+        return AVERROR(errno);
+    }
+#ifdef FICLONE
+    int out_fd = fd_open_write(dst);
+    if (out_fd >= 0 && ioctl(out_fd, FICLONE, in_fd) == 0) {
+        fd_close(out_fd);
+        fd_close(in_fd);
+        return 0;
+    }
+    if (out_fd >= 0) {
+        fd_close(out_fd);
+        remove(dst);
+    }
+#endif
+    if (link(src, dst) == 0) {
+        fd_close(in_fd);
+        return 0;
+    }
+    int ret = AVERROR(ENOMEM);
+    int64_t size = fd_seek(in_fd, 0, SEEK_END);
+    uint8_t* buf = (uint8_t*)av_malloc(COPY_BUFFER_SIZE);
+    int out = fd_open_write(dst);
+    if (size < 0 || out < 0) {
+        ret = AVERROR(errno);
+    }
+    else if (buf) {
+        ret = copy_range(in_fd, out, 0, 0, size, buf);
+    }
+    if (out >= 0 && fd_close(out) < 0 && ret >= 0) {
+        ret = AVERROR(errno);
+    }
+    fd_close(in_fd);
+    av_free(buf);
+    return ret;
+#endif
+}
+
+typedef struct JobPool JobPool;
+
+// ߳
+typedef struct {
+    JobPool* pool;
+    int index;              // ߳ţӦнеĲλ
+    int done;
+    int failed;
+    StageStats current;     // ڴͳ
+    int64_t live_objects;   // һʱ̳߳еĶ
+} WorkerContext;
+
+// ̶߳ɵأͨнзַ
+struct JobPool {
+    AVThreadMessageQueue* queue;
+    thread_t* threads;
+    WorkerContext* workers;
+    int nb_workers;
+    NameSet* outputNames;
+    MergeOptions options;
+    Manifest* manifest;     // ΪNULLʱת
+    int force;              // 嵥ȫºϲ
+    int skipped;            // ûб仯ľ缯ֻڽ߳޸
+    int planned;            // ʱɵֻڽ߳޸
+    int onlyComplete;       // ֻύɵľ缯ģʽδɵѭ
+    DedupTable* dedupTable; // ΪNULLʱȥ
+    RunStats* stats;        // ΪNULLʱͳƸ׶ʱ
+    atomic_counter_t prefetched;    // Ԥδ߳ȡߵԤ
+    char** inflight;        // ύδɵľ缯Ŀ¼
+    int nb_inflight;
+    int inflight_capacity;
+    mutex_t inflightLock;
+};
+
+// Ǽύľ缯ģʽݴ˱ͬһ缯ͬʱ
+static void mark_inflight(JobPool* pool, const char* episodeDir) {
+    mutex_lock(&pool->inflightLock);
+    if (pool->nb_inflight == pool->inflight_capacity) {
+        int capacity = pool->inflight_capacity ? pool->inflight_capacity * 2 : 16;
+        char** tmp = (char**)realloc(pool->inflight, capacity * sizeof(char*));
+        if (tmp) {
+            pool->inflight = tmp;
+            pool->inflight_capacity = capacity;
+        }
+    }
+    if (pool->nb_inflight < pool->inflight_capacity) {
+        pool->inflight[pool->nb_inflight++] = _strdup(episodeDir);
+    }
+    mutex_unlock(&pool->inflightLock);
+}
+
+static void clear_inflight(JobPool* pool, const char* episodeDir) {
+    mutex_lock(&pool->inflightLock);
+    for (int i = 0; i < pool->nb_inflight; i++) {
+        if (pool->inflight[i] && strcmp(pool->inflight[i], episodeDir) == 0) {
+            free(pool->inflight[i]);
+            pool->inflight[i] = pool->inflight[--pool->nb_inflight];
+            break;
+        }
+    }
+    mutex_unlock(&pool->inflightLock);
+}
+
+// 缯Ƿύδɵ
+int isJobInflight(JobPool* pool, const char* episodeDir) {
+    int found = 0;
+    mutex_lock(&pool->inflightLock);
+    for (int i = 0; i < pool->nb_inflight && !found; i++) {
+        found = pool->inflight[i] && strcmp(pool->inflight[i], episodeDir) == 0;
+    }
+    mutex_unlock(&pool->inflightLock);
+    return found;
+}
+
+static void free_job_msg(void* msg) {
+    free(*(MergeJob**)msg);
+}
+
+// ѡϲһ񣬺洦ʱ˵libavformat
+// дʱļɹ滻ظ缯ͬһӲӣ
+// ԭдĵںϲʧʱ𻵣
+static int run_merge_job(const MergeJob* job, const MergeOptions* options) {
+    int64_t start = thread_trace ? av_gettime_relative() : 0;
+    int ret = AVERROR_PATCHWELCOME;
+    char tmpPath[1040];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", job->outputFile);
+    if (options->engine == MERGE_ENGINE_BOX) {
+        ret = box_merge_audio_video(job->audioFile, job->videoFile, tmpPath);
+        if (ret == AVERROR_PATCHWELCOME) {
+            printf("libavformatϲ: %s\n", job->outputFile);
+        }
+    }
+    if (ret == AVERROR_PATCHWELCOME) {
+        ret = merge_audio_video(job->audioFile, job->videoFile, tmpPath, options);
+        if (ret == AVERROR_BUFFER_TOO_SMALL && options->faststart == FASTSTART_RESERVE) {
+            MergeOptions retry = *options;
+            retry.faststart = FASTSTART_REWRITE;
+            printf("Ԥmoovռ䲻㣬ºϲ: %s\n", job->outputFile);
+            ret = merge_audio_video(job->audioFile, job->videoFile, tmpPath, &retry);
+        }
+    }
+    if (ret == 0) {
+#ifdef _WIN32
+        remove(job->outputFile);
+#endif
+        if (rename(tmpPath, job->outputFile) != 0) {
+            ret = AVERROR(errno);
+            fprintf(stderr, "޷滻ļ %s\n", job->outputFile);
+        }
+    }
+    if (ret < 0) {
+        remove(tmpPath);
+    }
+    if (thread_trace) {
+        traceSpan("merge", "merge", job->outputFile, start, av_gettime_relative());
+    }
+    return ret;
+}
+
+// ͳд嵥ͷ
+static void finish_job(WorkerContext* ctx, MergeJob* job, int ret) {
+    int status;
+    if (ret == 0) {
+        printf("ϲ: %s\n", job->outputFile);
+        ctx->done++;
+        status = MANIFEST_DONE;
+    }
+    else {
+        printf("ϲʧ: %s\n", job->outputFile);
+        ctx->failed++;
+        status = MANIFEST_FAILED;
+    }
+    if (ctx->pool->manifest) {
+        updateManifest(ctx->pool->manifest, job->episodeDir, job->typeTag, job->outputFile, &job->sig, status);
+    }
+    // ֮߳䲻жʱĶй©
+    int64_t leaked = thread_live_objects - ctx->live_objects;
+    if (leaked != 0) {
+        fprintf(stderr, ": %s  %lld δͷ\n", job->outputFile, (long long)leaked);
+        ctx->live_objects = thread_live_objects;
+    }
+    if (ctx->pool->stats) {
+        struct stat statbuf;
+        StageStats* stats = &ctx->current;
+        stats->bytes_in = (stat(job->audioFile, &statbuf) == 0 ? statbuf.st_size : 0) +
+                          (stat(job->videoFile, &statbuf) == 0 ? statbuf.st_size : 0);
+        stats->bytes_out = ret == 0 && stat(job->outputFile, &statbuf) == 0 ? statbuf.st_size : 0;
+        stats->leaked = leaked;
+        get_process_memory(&stats->rss_kb, &stats->peak_rss_kb);
+        stats->heap_bytes = get_heap_bytes();
+        recordJobStats(ctx->pool->stats, job->outputFile, ret != 0, stats);
+    }
+    progress_end_job(job->sig.size[1] + job->sig.size[2], ret != 0, thread_stats);
+    memset(&ctx->current, 0, sizeof(ctx->current));
+    clear_inflight(ctx->pool, job->episodeDir);
+    free(job);
+}
+
+// ظľ缯ɹʱֱкϲ
+static void run_duplicate_job(WorkerContext* ctx, MergeJob* job, int state) {
+    int ret;
+    progress_begin_job();
+    int64_t start = thread_trace ? av_gettime_relative() : 0;
+    if (state == DEDUP_DONE && linkOutputFile(job->dedup->output, job->outputFile) == 0) {
+        printf("ͬ %s -> %s\n", job->outputFile, job->dedup->output);
+        if (thread_trace) {
+            traceSpan("merge", "link", job->outputFile, start, av_gettime_relative());
+        }
+        ret = 0;
+    }
+    else {
+        ret = run_merge_job(job, &ctx->pool->options);
+    }
+    finish_job(ctx, job, ret);
+}
+
+static THREAD_FUNC(merge_worker) {
+    WorkerContext* ctx = (WorkerContext*)arg;
+    MergeJob* job;
+    setThreadStats(ctx->pool->stats || metrics_enabled() ? &ctx->current : NULL);
+    setThreadProgress(ctx->index);
+    beginThreadTrace("merge");
+    while (av_thread_message_queue_recv(ctx->pool->queue, &job, 0) >= 0) {
+        trace_queue_depth("job_queue", ctx->pool->queue);
+        counter_add(&ctx->pool->prefetched, -job->prefetched);
+        DedupGroup* group = job->dedup;
+        int state;
+        // ظӣظ񵽴ʱ߳д
+        if (group && !job->dedupPrimary) {
+            if (!dedup_wait(group, job, &state)) {
+                run_duplicate_job(ctx, job, state);
+            }
+            continue;
+        }
+        progress_begin_job();
+        int ret = run_merge_job(job, &ctx->pool->options);
+        finish_job(ctx, job, ret);
+        if (group) {
+            int nb_waiting;
+            state = ret == 0 ? DEDUP_DONE : DEDUP_FAILED;
+            MergeJob** waiting = dedup_complete(group, state, &nb_waiting);
+            for (int i = 0; i < nb_waiting; i++) {
+                run_duplicate_job(ctx, waiting[i], state);
+            }
+            free(waiting);
+        }
+    }
+    return 0;
+}
+
+// أnb_workers<=0ʱʹCPUmanifestΪNULLʱ嵥ûб仯ľ缯
+// dedupΪ0ʱͬľ缯ֻϲһΣstatsΪNULLʱͳÿ׶εʱ
+int startJobPool(JobPool* pool, int nb_workers, const MergeOptions* options, Manifest* manifest, int force, int dedup,
+                 RunStats* stats) {
+    if (nb_workers <= 0) {
+        nb_workers = av_cpu_count();
+    }
+    memset(pool, 0, sizeof(*pool));
+    pool->options = *options;
+    pool->manifest = manifest;
+    pool->force = force;
+    pool->stats = stats;
+    mutex_init(&pool->inflightLock);
+    if (dedup && (pool->dedupTable = createDedupTable()) == NULL) {
+        fprintf(stderr, "޷ȥرβȥء\n");
+    }
+    if (av_thread_message_queue_alloc(&pool->queue, nb_workers * 2, sizeof(MergeJob*)) < 0) {
+        fprintf(stderr, "޷С\n");
+        return -1;
+    }
+    av_thread_message_queue_set_free_func(pool->queue, free_job_msg);
+    pool->threads = (thread_t*)calloc(nb_workers, sizeof(thread_t));
+    pool->workers = (WorkerContext*)calloc(nb_workers, sizeof(WorkerContext));
+    pool->outputNames = createNameSet(INITIAL_SIZE);
+    if (manifest) {
+        reserveManifestOutputs(manifest, pool->outputNames);
+    }
+    for (int i = 0; i < nb_workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (thread_create(&pool->threads[i], merge_worker, &pool->workers[i]) != 0) {
+            fprintf(stderr, "޷̡߳\n");
+            break;
+        }
+        pool->nb_workers++;
+    }
+    if (pool->nb_workers == 0) {
+        av_thread_message_queue_free(&pool->queue);
+        if (pool->dedupTable) {
+            freeDedupTable(pool->dedupTable);
+        }
+        mutex_destroy(&pool->inflightLock);
+        return -1;
+    }
+    return 0;
+}
+
+// Ϊļɨ߳аɨ˳䣬
+// 빤̵߳˳޹أʱ׷ _2_3 ...
+void claimOutputFile(JobPool* pool, const char* title, char* outputFile, size_t size) {
+    snprintf(outputFile, size, "videotrans/%s.mp4", title);
+    for (int n = 2; !addNameToSet(pool->outputNames, outputFile); n++) {
+        snprintf(outputFile, size, "videotrans/%s_%d.mp4", title, n);
+    }
+}
+
+// Ԥʱںں̨m4sͷݣʼΡļƬ
+// ߳ȡʱЩͨҳУٵȴн磬Ԥ
+// гȸԤδȡߵԤ㣬ʱԤ
+// entry.jsonǰɽ̶߳ҪԤ
+#define PREFETCH_FILE_BYTES (4 << 20)
+#define DEFAULT_PREFETCH_BUDGET (64 << 20)
+
+// ںԤļͷsizeֽڣֽ֧ʱ0
+static int64_t prefetch_file(const char* filename, int64_t size) {
+#ifdef __linux__
+    int fd = fd_open_read(filename);
+    if (fd < 0) {
+        return 0;
+    }
+    int ret = posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED);
+    fd_close(fd);
+    return ret == 0 ? size : 0;
+#else
+    (void)filename;
+    (void)size;
+    return 0;
+#endif
+}
+
+static void prefetch_job(JobPool* pool, MergeJob* job) {
+    int64_t audio = FFMIN(job->sig.size[1], PREFETCH_FILE_BYTES);
+    int64_t video = FFMIN(job->sig.size[2], PREFETCH_FILE_BYTES);
+    job->prefetched = 0;
+    if (counter_load(&pool->prefetched) + audio + video > pool->options.prefetch_budget) {
+        return;
+    }
+    job->prefetched = prefetch_file(job->audioFile, audio) + prefetch_file(job->videoFile, video);
+    counter_add(&pool->prefetched, job->prefetched);
+}
+
+// û̵ܽ߳ĵǼǲͷ
+static void discard_job(JobPool* pool, MergeJob* job) {
+    progressAddJob(-1, -(job->sig.size[1] + job->sig.size[2]));
+    counter_add(&pool->prefetched, -job->prefetched);
+    clear_inflight(pool, job->episodeDir);
+    free(job);
+}
+
+// ύ񣬶ʱֱй߳̿
+int submitJob(JobPool* pool, MergeJob* job) {
+    int64_t size = job->sig.size[1] + job->sig.size[2];
+    mark_inflight(pool, job->episodeDir);
+    prefetch_job(pool, job);
+    // ȵǼӣ̱߳ʱѼ
+    progressAddJob(1, size);
+    int ret = av_thread_message_queue_send(pool->queue, &job, 0);
+    trace_queue_depth("job_queue", pool->queue);
+    if (ret < 0) {
+        // 񲻻ִУȥΪʧܣڵȴظӺкϲ
+        if (job->dedup && job->dedupPrimary) {
+            int nb_waiting;
+            MergeJob** waiting = dedup_complete(job->dedup, DEDUP_FAILED, &nb_waiting);
+            for (int i = 0; i < nb_waiting; i++) {
+                // ߳ȡʱѿ۳Ԥ
+                waiting[i]->prefetched = 0;
+                if (av_thread_message_queue_send(pool->queue, &waiting[i], 0) < 0) {
+                    discard_job(pool, waiting[i]);
+                }
+            }
+            free(waiting);
+        }
+        discard_job(pool, job);
+    }
+    return ret;
+}
+
+// ֪ͨ߳û񣬵ȴȫɲͷأʧܵ
+int finishJobPool(JobPool* pool) {
+    int done = 0, failed = 0;
+    av_thread_message_queue_set_err_recv(pool->queue, AVERROR_EOF);
+    for (int i = 0; i < pool->nb_workers; i++) {
+        thread_join(pool->threads[i]);
+        done += pool->workers[i].done;
+        failed += pool->workers[i].failed;
+    }
+    setProgressQueue(PROGRESS_QUEUE_JOB, NULL);
+    if (pool->options.dry_run) {
+        printf("УҪϲ %d δ仯 %d \n", pool->planned, pool->skipped);
+    }
+    else {
+        printf("ϲ %d ʧ %d δ仯 %d \n", done, failed, pool->skipped);
+    }
+    av_thread_message_queue_free(&pool->queue);
+    freeNameSet(pool->outputNames);
+    if (pool->dedupTable) {
+        freeDedupTable(pool->dedupTable);
+    }
+    for (int i = 0; i < pool->nb_inflight; i++) {
+        free(pool->inflight[i]);
+    }
+    free(pool->inflight);
+    mutex_destroy(&pool->inflightLock);
+    free(pool->threads);
+    free(pool->workers);
+    return failed;
+}
+
+// ͷַ
+static void free_names(char** names, int nb_names) {
+    for (int i = 0; i < nb_names; i++) {
+        free(names[i]);
+    }
+    free(names);
+}
+
+// ɨ軺棺ϴɨõĸƵĿ¼޸ʱ;缯бԼ缯entry.json
+// ƵĿ¼޸ʱûʱֱʹûľ缯бöĿ¼
+// entry.jsonĴС޸ʱûʱֱʹûıtype_tagٶȡͽ
+#define SCAN_CACHE_PATH "videotrans/bv2video.scancache"
+#define SCAN_CACHE_MAGIC "BV2VSCN1"
+// ޸ʱɨ迪ʼ2Ŀ¼ļͬһʱ̶ٴα޸ģд뻺
+#define SCAN_CACHE_RACY_NS 2000000000LL
+
+typedef struct {
+    int64_t mtime;      // 룬-1ʾ
+    char** episodes;
+    int nb_episodes;
+} CachedDir;
+
+typedef struct {
+    int64_t size;
+    int64_t mtime;
+    char* title;
+    char* typeTag;
+} CachedEpisode;
+
+// ַĹϣ
+typedef struct {
+    char** keys;
+    void** values;
+    int size;
+    int capacity;
+    void (*free_value)(void* value);
+} CacheTable;
+
+typedef struct {
+    CacheTable oldDirs;     // ӻļ룬ɨڼֻ
+    CacheTable oldEpisodes;
+    CacheTable dirs;        // ɨĽֻɨ߳޸
+    CacheTable episodes;    // νĽֻڽ߳޸
+    char* basePath;
+    int64_t scanStart;
+} ScanCache;
+
+static int64_t stat_mtime_ns(const struct stat* statbuf) {
+#ifdef __linux__
+    return statbuf->st_mtim.tv_sec * 1000000000LL + statbuf->st_mtim.tv_nsec;
+#else
+    return statbuf->st_mtime * 1000000000LL;
+#endif
+}
+
+static void free_cached_dir(void* value) {
+    CachedDir* dir = (CachedDir*)value;
+    free_names(dir->episodes, dir->nb_episodes);
+    free(dir);
+}
+
+static void free_cached_episode(void* value) {
+    CachedEpisode* episode = (CachedEpisode*)value;
+    free(episode->title);
+    free(episode->typeTag);
+    free(episode);
+}
+
+static void cache_table_init(CacheTable* table, void (*free_value)(void*)) {
+    memset(table, 0, sizeof(*table));
+    table->free_value = free_value;
+}
+
+static int cache_table_index(const CacheTable* table, const char* key) {
+    unsigned int i = hash_string(key) & (table->capacity - 1);
+    while (table->keys[i] && strcmp(table->keys[i], key) != 0) {
+        i = (i + 1) & (table->capacity - 1);
+    }
+    return i;
+}
+
+static void* cache_table_find(const CacheTable* table, const char* key) {
+    if (table->capacity == 0) {
+        return NULL;
+    }
+    int i = cache_table_index(table, key);
+    return table->keys[i] ? table->values[i] : NULL;
+}
+
+// 뻺ӹvalueѴʱ滻ԭֵʧʱͷvalue-1
+static int cache_table_put(CacheTable* table, const char* key, void* value) {
+    if ((table->size + 1) * 2 > table->capacity) {
+        CacheTable grown = *table;
+        grown.capacity = table->capacity ? table->capacity * 2 : 256;
+        grown.keys = (char**)calloc(grown.capacity, sizeof(char*));
+        grown.values = (void**)calloc(grown.capacity, sizeof(void*));
+        if (grown.keys == NULL || grown.values == NULL) {
+            free(grown.keys);
+            free(grown.values);
+            table->free_value(value);
+            return -1;
+        }
+        for (int i = 0; i < table->capacity; i++) {
+            if (table->keys[i]) {
+                int j = cache_table_index(&grown, table->keys[i]);
+                grown.keys[j] = table->keys[i];
+                grown.values[j] = table->values[i];
+            }
+        }
+        free(table->keys);
+        free(table->values);
+        *table = grown;
+    }
+    int i = cache_table_index(table, key);
+    if (table->keys[i]) {
+        table->free_value(table->values[i]);
+    }
+    else if ((table->keys[i] = _strdup(key)) != NULL) {
+        table->size++;
+    }
+    else {
+        table->free_value(value);
+        return -1;
+    }
+    table->values[i] = value;
+    return 0;
+}
+
+static void cache_table_free(CacheTable* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->keys[i]) {
+            free(table->keys[i]);
+            table->free_value(table->values[i]);
+        }
+    }
+    free(table->keys);
+    free(table->values);
+    table->keys = NULL;
+    table->values = NULL;
+    table->size = table->capacity = 0;
+}
+
+// ļȡԽʱerrorȡ0մ
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;
+    int error;
+} CacheReader;
+
+static const uint8_t* cache_read(CacheReader* r, int64_t size) {
+    if (r->error || r->end - r->p < size) {
+        r->error = 1;
+        return NULL;
+    }
+    r->p += size;
+    return r->p - size;
+}
+
+static uint32_t cache_read_u32(CacheReader* r) {
+    const uint8_t* p = cache_read(r, 4);
+    return p ? AV_RL32(p) : 0;
+}
+
+static int64_t cache_read_i64(CacheReader* r) {
+    const uint8_t* p = cache_read(r, 8);
+    return p ? (int64_t)AV_RL64(p) : 0;
+}
+
+static char* cache_read_str(CacheReader* r) {
+    const uint8_t* p = cache_read(r, 2);
+    int len = p ? AV_RL16(p) : 0;
+    const uint8_t* s = cache_read(r, len);
+    char* str = s ? (char*)malloc(len + 1) : NULL;
+    if (str == NULL) {
+        r->error = 1;
+        return NULL;
+    }
+    memcpy(str, s, len);
+    str[len] = '\0';
+    return str;
+}
+
+static void cache_write_u32(FILE* file, uint32_t v) {
+    uint8_t b[4];
+    AV_WL32(b, v);
+    fwrite(b, 1, sizeof(b), file);
+}
+
+static void cache_write_i64(FILE* file, int64_t v) {
+    uint8_t b[8];
+    AV_WL64(b, v);
+    fwrite(b, 1, sizeof(b), file);
+}
+
+static void cache_write_str(FILE* file, const char* str) {
+    uint8_t b[2];
+    size_t len = FFMIN(strlen(str), UINT16_MAX);
+    AV_WL16(b, len);
+    fwrite(b, 1, sizeof(b), file);
+    fwrite(str, 1, len, file);
+}
+
+static void cache_load(ScanCache* cache, CacheReader* r) {
+    char* basePath = cache_read_str(r);
+    int same_base = basePath && strcmp(basePath, cache->basePath) == 0;
+    free(basePath);
+    if (!same_base) {
+        return;
+    }
+    uint32_t nb_dirs = cache_read_u32(r);
+    for (uint32_t i = 0; i < nb_dirs && !r->error; i++) {
+        char* name = cache_read_str(r);
+        CachedDir* dir = (CachedDir*)calloc(1, sizeof(CachedDir));
+        uint32_t nb_episodes = cache_read_u32(r);
+        if (dir == NULL || r->error || nb_episodes > (uint32_t)(r->end - r->p) / 2 ||
+            (nb_episodes && (dir->episodes = (char**)calloc(nb_episodes, sizeof(char*))) == NULL)) {
+            r->error = 1;
+        }
+        if (dir) {
+            dir->mtime = cache_read_i64(r);
+        }
+        for (uint32_t j = 0; j < nb_episodes && !r->error; j++) {
+            if ((dir->episodes[j] = cache_read_str(r)) != NULL) {
+                dir->nb_episodes++;
+            }
+        }
+        if (!r->error) {
+            cache_table_put(&cache->oldDirs, name, dir);
+        }
+        else if (dir) {
+            free_cached_dir(dir);
+        }
+        free(name);
+    }
+    uint32_t nb_episodes = cache_read_u32(r);
+    for (uint32_t i = 0; i < nb_episodes && !r->error; i++) {
+        char* path = cache_read_str(r);
+        CachedEpisode* episode = (CachedEpisode*)calloc(1, sizeof(CachedEpisode));
+        if (episode == NULL) {
+            r->error = 1;
+        }
+        else {
+            episode->size = cache_read_i64(r);
+            episode->mtime = cache_read_i64(r);
+            episode->title = cache_read_str(r);
+            episode->typeTag = cache_read_str(r);
+        }
+        if (!r->error) {
+            cache_table_put(&cache->oldEpisodes, path, episode);
+        }
+        else if (episode) {
+            free_cached_episode(episode);
+        }
+        free(path);
+    }
+}
+
+// ɨ軺档ļڡ𻵻ӦĲbasePathʱӿջ濪ʼ
+ScanCache* loadScanCache(const char* path, const char* basePath) {
+    ScanCache* cache = (ScanCache*)calloc(1, sizeof(ScanCache));
+    if (cache == NULL || (cache->basePath = _strdup(basePath)) == NULL) {
+        free(cache);
+        return NULL;
+    }
+    cache_table_init(&cache->oldDirs, free_cached_dir);
+    cache_table_init(&cache->oldEpisodes, free_cached_episode);
+    cache_table_init(&cache->dirs, free_cached_dir);
+    cache_table_init(&cache->episodes, free_cached_episode);
+    cache->scanStart = (int64_t)time(NULL) * 1000000000LL;
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return cache;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t* data = length > 0 ? (uint8_t*)malloc(length) : NULL;
+    if (data && fread(data, 1, length, file) == (size_t)length) {
+        CacheReader reader = { data, data + length, 0 };
+        const uint8_t* magic = cache_read(&reader, sizeof(SCAN_CACHE_MAGIC) - 1);
+        if (magic && memcmp(magic, SCAN_CACHE_MAGIC, sizeof(SCAN_CACHE_MAGIC) - 1) == 0) {
+            cache_load(cache, &reader);
+        }
+        if (reader.error) {
+            printf("ɨ軺𻵣ɨ: %s\n", path);
+        }
+    }
+    free(data);
+    fclose(file);
+    printf("ɨ軺 %d Ŀ¼%d 缯\n", cache->oldDirs.size, cache->oldEpisodes.size);
+    return cache;
+}
+
+// 汾ɨͽĽдʱļ滻ԭļ
+int saveScanCache(ScanCache* cache, const char* path) {
+    char tmpPath[1024];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE* file = fopen(tmpPath, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    fwrite(SCAN_CACHE_MAGIC, 1, sizeof(SCAN_CACHE_MAGIC) - 1, file);
+    cache_write_str(file, cache->basePath);
+    cache_write_u32(file, cache->dirs.size);
+    for (int i = 0; i < cache->dirs.capacity; i++) {
+        if (cache->dirs.keys[i]) {
+            CachedDir* dir = (CachedDir*)cache->dirs.values[i];
+            cache_write_str(file, cache->dirs.keys[i]);
+            cache_write_u32(file, dir->nb_episodes);
+            cache_write_i64(file, dir->mtime);
+            for (int j = 0; j < dir->nb_episodes; j++) {
+                cache_write_str(file, dir->episodes[j]);
+            }
+        }
+    }
+    cache_write_u32(file, cache->episodes.size);
+    for (int i = 0; i < cache->episodes.capacity; i++) {
+        if (cache->episodes.keys[i]) {
+            CachedEpisode* episode = (CachedEpisode*)cache->episodes.values[i];
+            cache_write_str(file, cache->episodes.keys[i]);
+            cache_write_i64(file, episode->size);
+            cache_write_i64(file, episode->mtime);
+            cache_write_str(file, episode->title);
+            cache_write_str(file, episode->typeTag);
+        }
+    }
+    if (ferror(file) | fclose(file)) {
+        remove(tmpPath);
+        return -1;
+    }
+#ifdef _WIN32
+    remove(path);
+#endif
+    if (rename(tmpPath, path) != 0) {
+        remove(tmpPath);
+        return -1;
+    }
+    return 0;
+}
+
+void freeScanCache(ScanCache* cache) {
+    cache_table_free(&cache->oldDirs);
+    cache_table_free(&cache->oldEpisodes);
+    cache_table_free(&cache->dirs);
+    cache_table_free(&cache->episodes);
+    free(cache->basePath);
+    free(cache);
+}
+
+// ޸ʱ뱾ɨ迪ʼ̫ʱ
+static int64_t cache_mtime(const ScanCache* cache, int64_t mtime) {
+    return mtime > cache->scanStart - SCAN_CACHE_RACY_NS ? -1 : mtime;
+}
+
+// Ŀ¼Ļ缯б޸ʱһʱһݷ1
+static int cache_lookup_dir(const ScanCache* cache, const char* name, int64_t mtime, char*** episodes, int* nb_episodes) {
+    CachedDir* dir = (CachedDir*)cache_table_find(&cache->oldDirs, name);
+    if (dir == NULL || dir->mtime < 0 || dir->mtime != mtime) {
+        return 0;
+    }
+    *episodes = (char**)calloc(FFMAX(dir->nb_episodes, 1), sizeof(char*));
+    *nb_episodes = 0;
+    if (*episodes == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < dir->nb_episodes; i++) {
+        if (((*episodes)[*nb_episodes] = _strdup(dir->episodes[i])) != NULL) {
+            (*nb_episodes)++;
+        }
+    }
+    return 1;
+}
+
+// ¼Ŀ¼ľ缯бӹepisodes
+static void cache_store_dir(ScanCache* cache, const char* name, int64_t mtime, char** episodes, int nb_episodes) {
+    CachedDir* dir = (CachedDir*)calloc(1, sizeof(CachedDir));
+    if (dir == NULL) {
+        free_names(episodes, nb_episodes);
+        return;
+    }
+    dir->mtime = mtime < 0 ? -1 : cache_mtime(cache, mtime);
+    dir->episodes = episodes;
+    dir->nb_episodes = nb_episodes;
+    cache_table_put(&cache->dirs, name, dir);
+}
+
+static void cache_store_episode(ScanCache* cache, const char* path, int64_t size, int64_t mtime,
+                                const char* title, const char* typeTag) {
+    CachedEpisode* episode = (CachedEpisode*)calloc(1, sizeof(CachedEpisode));
+    if (episode == NULL) {
+        return;
+    }
+    episode->size = size;
+    episode->mtime = mtime;
+    episode->title = _strdup(title);
+    episode->typeTag = _strdup(typeTag);
+    if (episode->title == NULL || episode->typeTag == NULL) {
+        free_cached_episode(episode);
+        return;
+    }
+    cache_table_put(&cache->episodes, path, episode);
+}
+
+// ϴεĽԭεĻУ缯嵥ûнʱ
+static void cache_keep_episode(ScanCache* cache, const char* path) {
+    CachedEpisode* episode = (CachedEpisode*)cache_table_find(&cache->oldEpisodes, path);
+    if (episode) {
+        cache_store_episode(cache, path, episode->size, episode->mtime, episode->title, episode->typeTag);
+    }
+}
+
+// ɨ׶Σbilibili_videoÿƵһĿ¼ÿ缯һĿ¼
+// ƵĿ¼ɶ̲߳ö٣readdir˳򽻸׶Σļķ˳̵߳Ӱ졣
+// ʹreaddirصd_typeжǷΪĿ¼ļϵͳṩʱstat
+// POSIXĿ¼fdĿ¼openat/fstatatΪÿĿƴ·
+#define SCAN_THREADS 8
+// ö߳Ƚ׶εĿ¼ݴռõڴ
+#define SCAN_WINDOW 256
+
+typedef struct {
+    char* name;         // ƵĿ¼
+    char** episodes;    // 缯Ŀ¼
+    int nb_episodes;
+    int64_t mtime;      // öǰȡõ޸ʱ䣬-1ʾδ֪
+    int done;
+} ScanSlot;
+
+typedef struct {
+    const char* basePath;
+#ifndef _WIN32
+    int baseFd;
+#endif
+    ScanCache* cache;   // ΪNULLʱʹɨ軺
+    ScanSlot* slots;
+    int nb_slots;
+    int next;       // һöٵĿ¼
+    int emitted;    // ѽ׶εĿ¼
+    mutex_t lock;
+    cond_t cond;
+} DirScan;
+
+// жĿ¼ǷΪĿ¼ӣstatһ£
+static int is_directory(const struct dirent* entry, int dir_fd, const char* dirPath) {
+    struct stat statbuf;
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+        return 0;
+    }
+    if (entry->d_type == DT_DIR) {
+        return 1;
+    }
+    if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK) {
+        return 0;
+    }
+#ifdef _WIN32
+    char path[1024];
+    (void)dir_fd;
+    snprintf(path, sizeof(path), "%s/%s", dirPath, entry->d_name);
+    return stat(path, &statbuf) == 0 && S_ISDIR(statbuf.st_mode);
+#else
+    (void)dirPath;
+    return fstatat(dir_fd, entry->d_name, &statbuf, 0) == 0 && S_ISDIR(statbuf.st_mode);
+#endif
+}
+
+// гĿ¼еĿ¼
+static void list_subdirs(DIR* dp, const char* dirPath, char*** names, int* nb_names) {
+    struct dirent* entry;
+    int capacity = 0;
+#ifdef _WIN32
+    int dir_fd = -1;
+#else
+    int dir_fd = dirfd(dp);
+#endif
+    *names = NULL;
+    *nb_names = 0;
+    while ((entry = readdir(dp))) {
+        if (!is_directory(entry, dir_fd, dirPath)) {
+            continue;
+        }
+        if (*nb_names == capacity) {
+            int new_capacity = capacity ? capacity * 2 : 8;
+            char** tmp = (char**)realloc(*names, new_capacity * sizeof(char*));
+            if (tmp == NULL) {
+                fprintf(stderr, "ڴʧ\n");
+                break;
+            }
+            *names = tmp;
+            capacity = new_capacity;
+        }
+        if (((*names)[*nb_names] = _strdup(entry->d_name)) != NULL) {
+            (*nb_names)++;
+        }
+    }
+}
+
+// öһƵĿ¼µľ缯Ŀ¼޸ʱ뻺һʱֱʹûĽ
+static void scan_video_dir(DirScan* scan, ScanSlot* slot) {
+    char path[1024];
+    struct stat statbuf;
+    snprintf(path, sizeof(path), "%s/%s", scan->basePath, slot->name);
+    slot->mtime = -1;
+    if (scan->cache) {
+#ifdef _WIN32
+        int ret = stat(path, &statbuf);
+#else
+        int ret = fstatat(scan->baseFd, slot->name, &statbuf, 0);
+#endif
+        if (ret == 0) {
+            slot->mtime = stat_mtime_ns(&statbuf);
+            if (cache_lookup_dir(scan->cache, slot->name, slot->mtime, &slot->episodes, &slot->nb_episodes)) {
+                return;
+            }
+        }
     }
-
-    // дƵݰ
-    while (av_read_frame(input_format_ctx_video, &packet) >= 0) {
-        packet.stream_index = out_video_stream->index;
-        av_packet_rescale_ts(&packet, video_stream->time_base, out_video_stream->time_base);
-        av_interleaved_write_frame(output_format_ctx, &packet);
-        av_packet_unref(&packet);
+#ifdef _WIN32
+    DIR* dp = opendir(path);
+#else
+    int fd = openat(scan->baseFd, slot->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR* dp = fd >= 0 ? fdopendir(fd) : NULL;
+    if (dp == NULL && fd >= 0) {
+        close(fd);
     }
-
-    av_write_trailer(output_format_ctx);
-
-    avformat_close_input(&input_format_ctx_audio);
-    avformat_close_input(&input_format_ctx_video);
-
-    if (!(output_format->flags & AVFMT_NOFILE)) {
-        avio_closep(&output_format_ctx->pb);
+#endif
+    if (dp == NULL) {
+        perror("opendir");
+        slot->mtime = -1;
+        return;
     }
-    avformat_free_context(output_format_ctx);
-    return 0;
+    list_subdirs(dp, path, &slot->episodes, &slot->nb_episodes);
+    closedir(dp);
 }
 
-
-
-void format_filename(char* filename) {
-    char* src = filename, * dst = filename;
-    while (*src) {
-        // ֻĸ֡»ߺַ
-        if (isalnum((unsigned char)*src) || *src == '_' || (*src & 0x80)) {
-            *dst++ = *src;
+static THREAD_FUNC(scan_worker) {
+    DirScan* scan = (DirScan*)arg;
+    beginThreadTrace("scan");
+    mutex_lock(&scan->lock);
+    for (;;) {
+        while (scan->next < scan->nb_slots && scan->next >= scan->emitted + SCAN_WINDOW) {
+            cond_wait(&scan->cond, &scan->lock);
         }
-        src++;
+        if (scan->next >= scan->nb_slots) {
+            break;
+        }
+        ScanSlot* slot = &scan->slots[scan->next++];
+        mutex_unlock(&scan->lock);
+        int64_t start = thread_trace ? av_gettime_relative() : 0;
+        scan_video_dir(scan, slot);
+        if (thread_trace) {
+            traceSpan("scan", "scan_dir", slot->name, start, av_gettime_relative());
+        }
+        mutex_lock(&scan->lock);
+        slot->done = 1;
+        cond_broadcast(&scan->cond);
     }
-    *dst = '\0';
+    mutex_unlock(&scan->lock);
+    return 0;
 }
 
-void processDirectory(const char* path);
+// basePathÿ缯Ŀ¼˳򽻸׶Σʱ缯Ŀ¼·pathsУ
+// ׶βҪͷšnb_threadsΪöƵĿ¼߳cacheΪNULLʱʹòɨ軺
+void traverseDirectory(const char* basePath, DynamicArray* folders, AVThreadMessageQueue* dirQueue, int nb_threads,
+                       ScanCache* cache, PathPool* paths) {
+    DirScan scan = { 0 };
+    char** names;
+    thread_t* threads;
+    int nb_started = 0;
 
-void traverseDirectory(const char* basePath, DynamicArray* folders) {
-    struct dirent* entry;
-    struct stat statbuf;
     DIR* dp = opendir(basePath);
     if (dp == NULL) {
         perror("opendir");
         return;
     }
-    while ((entry = readdir(dp))) {
+    scan.basePath = basePath;
+    scan.cache = cache;
+#ifndef _WIN32
+    scan.baseFd = dirfd(dp);
+#endif
+    list_subdirs(dp, basePath, &names, &scan.nb_slots);
+    scan.slots = (ScanSlot*)calloc(scan.nb_slots ? scan.nb_slots : 1, sizeof(ScanSlot));
+    if (scan.slots == NULL) {
+        fprintf(stderr, "ڴʧ\n");
+        free_names(names, scan.nb_slots);
+        closedir(dp);
+        return;
+    }
+    for (int i = 0; i < scan.nb_slots; i++) {
+        scan.slots[i].name = names[i];
+    }
+    free(names);
+
+    mutex_init(&scan.lock);
+    cond_init(&scan.cond);
+    if (nb_threads <= 0) {
+        nb_threads = SCAN_THREADS;
+    }
+    nb_threads = FFMIN(nb_threads, FFMAX(scan.nb_slots, 1));
+    threads = (thread_t*)calloc(nb_threads, sizeof(thread_t));
+    for (int i = 0; threads && i < nb_threads; i++) {
+        if (thread_create(&threads[i], scan_worker, &scan) != 0) {
+            break;
+        }
+        nb_started++;
+    }
+
+    for (int i = 0; i < scan.nb_slots; i++) {
+        ScanSlot* slot = &scan.slots[i];
         char path[1024];
-        snprintf(path, sizeof(path), "%s/%s", basePath, entry->d_name);
-        if (stat(path, &statbuf) == 0 && S_ISDIR(statbuf.st_mode) && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-            addName(folders, path);
-            printf("ǰĿ¼: %s\n", path);
+        // ûпõö߳ʱڵǰ߳ö
+        if (nb_started == 0) {
+            scan_video_dir(&scan, slot);
+        }
+        else {
+            mutex_lock(&scan.lock);
+            while (!slot->done) {
+                cond_wait(&scan.cond, &scan.lock);
+            }
+            mutex_unlock(&scan.lock);
+        }
 
-            // processDirectoryÿĿ¼
-            processDirectory(path);
+        snprintf(path, sizeof(path), "%s/%s", basePath, slot->name);
+        addName(folders, path);
+        printf("ǰĿ¼: %s\n", path);
+        for (int j = 0; j < slot->nb_episodes; j++) {
+            char subPath[1024];
+            snprintf(subPath, sizeof(subPath), "%s/%s", path, slot->episodes[j]);
+            const char* episodeDir = internPath(paths, subPath);
+            if (episodeDir) {
+                av_thread_message_queue_send(dirQueue, &episodeDir, 0);
+                trace_queue_depth("dir_queue", dirQueue);
+            }
+        }
+        if (cache) {
+            cache_store_dir(cache, slot->name, slot->mtime, slot->episodes, slot->nb_episodes);
         }
+        else {
+            free_names(slot->episodes, slot->nb_episodes);
+        }
+        free(slot->name);
+
+        mutex_lock(&scan.lock);
+        scan.emitted++;
+        cond_broadcast(&scan.cond);
+        mutex_unlock(&scan.lock);
     }
+
+    for (int i = 0; i < nb_started; i++) {
+        thread_join(threads[i]);
+    }
+    free(threads);
+    cond_destroy(&scan.cond);
+    mutex_destroy(&scan.lock);
+    free(scan.slots);
     closedir(dp);
 }
 
@@ -320,77 +5309,757 @@ void traverseDirectory(const char* basePath, DynamicArray* folders) {
 //}
 
 
-void processDirectory(const char* path) {
-    struct dirent* entry;
+// ȡ缯type_tagͱ⡣cacheΪNULLʱentry.jsonĴС޸ʱ뻺һ¾ֱûĽ
+static int readEpisodeInfo(const char* subPath, ScanCache* cache, char* typeTag, size_t typeTagSize,
+                           char* titleBuf, size_t titleSize) {
+    char entryPath[1024];
     struct stat statbuf;
+    int64_t mtime = -1;
+    int ret = -1;
+    snprintf(entryPath, sizeof(entryPath), "%s/entry.json", subPath);
+
+    if (cache && stat(entryPath, &statbuf) == 0) {
+        mtime = cache_mtime(cache, stat_mtime_ns(&statbuf));
+        CachedEpisode* cached = (CachedEpisode*)cache_table_find(&cache->oldEpisodes, subPath);
+        if (cached && mtime >= 0 && cached->mtime == mtime && cached->size == statbuf.st_size) {
+            snprintf(typeTag, typeTagSize, "%s", cached->typeTag);
+            snprintf(titleBuf, titleSize, "%s", cached->title);
+            cache_store_episode(cache, subPath, cached->size, cached->mtime, cached->title, cached->typeTag);
+            return 0;
+        }
+    }
+
+    char* jsonContent = read_file(entryPath);
+    if (jsonContent == NULL) {
+        return -1;
+    }
+    // ֻͨɨһıȡʽ淶ʱcJSON
+    static const char* const keys[2] = { "type_tag", "title" };
+    JsonValue values[2];
+    if (json_find_keys(jsonContent, strlen(jsonContent), keys, values, 2) == 2 &&
+        json_get_string(&values[0], typeTag, typeTagSize) == 0 && json_get_string(&values[1], titleBuf, titleSize) == 0) {
+        if (cache && mtime >= 0) {
+            cache_store_episode(cache, subPath, statbuf.st_size, mtime, titleBuf, typeTag);
+        }
+        job_free(jsonContent);
+        return 0;
+    }
+
+    cJSON* root = cJSON_Parse(jsonContent);
+    if (root == NULL) {
+        printf("JSONļʧ\n");
+    }
+    else {
+        cJSON* type = cJSON_GetObjectItem(root, "type_tag");
+        cJSON* title = cJSON_GetObjectItem(root, "title");
+        if (type != NULL && cJSON_IsString(type) && title != NULL && cJSON_IsString(title)) {
+            snprintf(typeTag, typeTagSize, "%s", type->valuestring);
+            snprintf(titleBuf, titleSize, "%s", title->valuestring);
+            if (cache && mtime >= 0) {
+                cache_store_episode(cache, subPath, statbuf.st_size, mtime, titleBuf, typeTag);
+            }
+            ret = 0;
+        }
+        else {
+            printf("δҵtype_tagtitleǩ\n");
+        }
+        cJSON_Delete(root);
+    }
+    job_free(jsonContent);
+    return ret;
+}
+
+// ׶Σȡ缯Ŀ¼µentry.jsonɺϲ
+static int isEpisodeComplete(const char* episodeDir);
+
+void parseEpisode(const char* subPath, JobPool* pool, ScanCache* cache) {
+    char previousOutput[1024] = "";
+    char typeTag[MAX_NAME_LEN], title[1024];
+
+    // 嵥м¼ûб仯ļҲʱֱؽentry.json
+    if (pool->manifest && lookupManifest(pool->manifest, subPath, previousOutput, sizeof(previousOutput)) && !pool->force) {
+        if (cache) {
+            cache_keep_episode(cache, subPath);
+        }
+        pool->skipped++;
+        return;
+    }
+    // صľ缯m4sentry.jsonʾɺɼѭύ
+    if (pool->onlyComplete && !isEpisodeComplete(subPath)) {
+        printf("δɣԺת: %s\n", subPath);
+        return;
+    }
+    if (readEpisodeInfo(subPath, cache, typeTag, sizeof(typeTag), title, sizeof(title)) < 0) {
+        return;
+    }
+    printf("type_tag: %s\n", typeTag);
+    printf("title: %s\n", title);
+
+    char formatted_title[256];
+    strncpy_s(formatted_title, sizeof(formatted_title), title, _TRUNCATE);
+    format_filename(formatted_title);
+
+    char targetDir[1024];
+    snprintf(targetDir, sizeof(targetDir), "%s/%s", subPath, typeTag);
+    printf("ĿĿ¼: %s\n", targetDir);
+
+    MergeJob* job = (MergeJob*)malloc(sizeof(MergeJob));
+    if (job == NULL) {
+        printf("ڴʧ\n");
+        return;
+    }
+    snprintf(job->audioFile, sizeof(job->audioFile), "%s/audio.m4s", targetDir);
+    snprintf(job->videoFile, sizeof(job->videoFile), "%s/video.m4s", targetDir);
+    snprintf(job->episodeDir, sizeof(job->episodeDir), "%s", subPath);
+    snprintf(job->typeTag, sizeof(job->typeTag), "%s", typeTag);
+    if (getEpisodeSignature(subPath, job->typeTag, &job->sig) < 0) {
+        memset(&job->sig, 0, sizeof(job->sig));
+    }
+    // ǰתľ缯ԭļʱǼǣ
+    if (previousOutput[0]) {
+        snprintf(job->outputFile, sizeof(job->outputFile), "%s", previousOutput);
+    }
+    else {
+        claimOutputFile(pool, formatted_title, job->outputFile, sizeof(job->outputFile));
+    }
+    printf("ļ: %s\n", job->outputFile);
+    if (pool->options.dry_run) {
+        pool->planned++;
+        free(job);
+        return;
+    }
+    job->dedup = NULL;
+    job->dedupPrimary = 0;
+    if (pool->dedupTable) {
+        assignDedupGroup(pool->dedupTable, job);
+    }
+    submitJob(pool, job);
+}
+
+// ˮߣɨ߳ -> ߳ -> ϲ̣߳ڽ׶֮нӣ
+// δʱλڶ
+typedef struct {
+    const char* basePath;
+    DynamicArray* folders;
+    AVThreadMessageQueue* dirQueue;
+    JobPool* pool;
+    ScanCache* cache;
+    PathPool* paths;
+    int nb_scan_threads;
+    thread_t scanner;
+    thread_t parser;
+    int64_t scanTime;       // ɨ̵߳ʱ΢룩
+    int64_t parseTime;      // 缯ۼʱ΢룩ȴɨʱ
+    int nb_episodes;
+} Pipeline;
+
+#define DIR_QUEUE_SIZE 64
+
+static THREAD_FUNC(scanner_thread) {
+    Pipeline* pipeline = (Pipeline*)arg;
+    beginThreadTrace("scanner");
+    int64_t start = av_gettime_relative();
+    traverseDirectory(pipeline->basePath, pipeline->folders, pipeline->dirQueue, pipeline->nb_scan_threads,
+                      pipeline->cache, pipeline->paths);
+    int64_t end = av_gettime_relative();
+    pipeline->scanTime = end - start;
+    traceSpan("scan", "scan", pipeline->basePath, start, end);
+    av_thread_message_queue_set_err_recv(pipeline->dirQueue, AVERROR_EOF);
+    return 0;
+}
+
+static THREAD_FUNC(parser_thread) {
+    Pipeline* pipeline = (Pipeline*)arg;
+    const char* episodeDir;
+    Arena arena = { 0 };
+    // entry.jsonݺcJSONڵڴط䣬ÿ缯һͷ
+    setThreadArena(&arena);
+    beginThreadTrace("parser");
+    while (av_thread_message_queue_recv(pipeline->dirQueue, &episodeDir, 0) >= 0) {
+        trace_queue_depth("dir_queue", pipeline->dirQueue);
+        int64_t start = av_gettime_relative();
+        int64_t live_objects = thread_live_objects;
+        parseEpisode(episodeDir, pipeline->pool, pipeline->cache);
+        if (thread_live_objects != live_objects) {
+            fprintf(stderr, ":  %s  %lld δͷ\n", episodeDir,
+                    (long long)(thread_live_objects - live_objects));
+            if (pipeline->pool->stats) {
+                pipeline->pool->stats->parse_leaks++;
+            }
+            thread_live_objects = live_objects;
+        }
+        arena_reset(&arena);
+        int64_t end = av_gettime_relative();
+        int64_t time = end - start;
+        traceSpan("parse", "parse", episodeDir, start, end);
+        pipeline->parseTime += time;
+        pipeline->nb_episodes++;
+        if (pipeline->pool->stats) {
+            recordParseTime(pipeline->pool->stats, time);
+        }
+    }
+    setThreadArena(NULL);
+    arena_free(&arena);
+    return 0;
+}
+
+// ɨͽ̣߳nb_scan_threads<=0ʱʹĬϵö߳cacheΪNULLʱʹɨ軺档
+// 缯Ŀ¼·pathsУˮ߽ȻЧ
+int startPipeline(Pipeline* pipeline, const char* basePath, DynamicArray* folders, JobPool* pool, int nb_scan_threads,
+                  ScanCache* cache, PathPool* paths) {
+    memset(pipeline, 0, sizeof(*pipeline));
+    pipeline->cache = cache;
+    pipeline->paths = paths;
+    pipeline->nb_scan_threads = nb_scan_threads;
+    pipeline->basePath = basePath;
+    pipeline->folders = folders;
+    pipeline->pool = pool;
+    if (av_thread_message_queue_alloc(&pipeline->dirQueue, DIR_QUEUE_SIZE, sizeof(const char*)) < 0) {
+        fprintf(stderr, "޷Ŀ¼С\n");
+        return -1;
+    }
+    setProgressQueue(PROGRESS_QUEUE_DIR, pipeline->dirQueue);
+    if (thread_create(&pipeline->parser, parser_thread, pipeline) != 0) {
+        fprintf(stderr, "޷̡߳\n");
+        setProgressQueue(PROGRESS_QUEUE_DIR, NULL);
+        av_thread_message_queue_free(&pipeline->dirQueue);
+        return -1;
+    }
+    if (thread_create(&pipeline->scanner, scanner_thread, pipeline) != 0) {
+        fprintf(stderr, "޷ɨ̡߳\n");
+        av_thread_message_queue_set_err_recv(pipeline->dirQueue, AVERROR_EOF);
+        thread_join(pipeline->parser);
+        setProgressQueue(PROGRESS_QUEUE_DIR, NULL);
+        av_thread_message_queue_free(&pipeline->dirQueue);
+        return -1;
+    }
+    return 0;
+}
+
+// ȴɨͽ˺󲻻ءɨͽʱ׼
+// һй̶ʽASCIIstage_times key=value ...ܲԶȡʾֺͿ̨Ӱ
+void finishPipeline(Pipeline* pipeline) {
+    thread_join(pipeline->scanner);
+    thread_join(pipeline->parser);
+    setProgressQueue(PROGRESS_QUEUE_DIR, NULL);
+    av_thread_message_queue_free(&pipeline->dirQueue);
+    fprintf(stderr, "ɨʱ %.6f 룬ʱ %.6f 룬 %d 缯\n", pipeline->scanTime / 1e6,
+            pipeline->parseTime / 1e6, pipeline->nb_episodes);
+    fprintf(stderr, "stage_times scan_s=%.6f parse_s=%.6f episodes=%d\n", pipeline->scanTime / 1e6,
+            pipeline->parseTime / 1e6, pipeline->nb_episodes);
+}
+
+// ģʽɨ֮bilibili_video缯entry.jsonʾɺ
+// ֻ缯أٶȫɨ衣LinuxinotifyƵĿ¼;缯Ŀ¼
+// WindowsReadDirectoryChangesWĿ¼
+#define WATCH_DEBOUNCE (5 * AV_TIME_BASE)   // entry.jsonһα仯ȴʱ䣨΢룩
+
+static volatile sig_atomic_t watch_stop;
+
+static void watch_signal_handler(int sig) {
+    (void)sig;
+    watch_stop = 1;
+}
+
+// ȴľ缯
+typedef struct {
+    char path[1024];
+    int64_t due;
+} PendingEpisode;
+
+typedef struct {
+    const char* basePath;
+    PendingEpisode* pending;
+    int nb_pending;
+    int pending_capacity;
+#ifdef _WIN32
+    HANDLE dir;
+    OVERLAPPED overlapped;
+    DWORD buffer[16384];
+#elif defined(__linux__)
+    int fd;
+    char** paths;   // ԼΪ±Ŀ¼·
+    int* depths;    // 0ΪbasePath1ΪƵĿ¼2Ϊ缯Ŀ¼
+    int nb_paths;
+#endif
+} DirWatcher;
+
+// ǼǾ缯ûµı仯WATCH_DEBOUNCE֮ټ
+static void watch_schedule(DirWatcher* watcher, const char* episodeDir) {
+    int64_t due = av_gettime_relative() + WATCH_DEBOUNCE;
+    for (int i = 0; i < watcher->nb_pending; i++) {
+        if (strcmp(watcher->pending[i].path, episodeDir) == 0) {
+            watcher->pending[i].due = due;
+            return;
+        }
+    }
+    if (watcher->nb_pending == watcher->pending_capacity) {
+        int capacity = watcher->pending_capacity ? watcher->pending_capacity * 2 : 16;
+        PendingEpisode* tmp = (PendingEpisode*)realloc(watcher->pending, capacity * sizeof(PendingEpisode));
+        if (tmp == NULL) {
+            fprintf(stderr, "ڴʧ\n");
+            return;
+        }
+        watcher->pending = tmp;
+        watcher->pending_capacity = capacity;
+    }
+    snprintf(watcher->pending[watcher->nb_pending].path, sizeof(watcher->pending[0].path), "%s", episodeDir);
+    watcher->pending[watcher->nb_pending].due = due;
+    watcher->nb_pending++;
+}
+
+#ifdef __linux__
+static void watch_add(DirWatcher* watcher, const char* path, int depth) {
+    uint32_t mask = depth < 2 ? IN_CREATE | IN_MOVED_TO | IN_ONLYDIR : IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR;
+    int wd = inotify_add_watch(watcher->fd, path, mask);
+    if (wd < 0) {
+        fprintf(stderr, "޷Ŀ¼ %s: %s\n", path, strerror(errno));
+        return;
+    }
+    if (wd >= watcher->nb_paths) {
+        int nb_paths = FFMAX(wd + 1, watcher->nb_paths * 2);
+        char** paths = (char**)realloc(watcher->paths, nb_paths * sizeof(char*));
+        int* depths = paths ? (int*)realloc(watcher->depths, nb_paths * sizeof(int)) : NULL;
+        if (paths) {
+            watcher->paths = paths;
+        }
+        if (depths == NULL) {
+            fprintf(stderr, "ڴʧ\n");
+            inotify_rm_watch(watcher->fd, wd);
+            return;
+        }
+        watcher->depths = depths;
+        memset(watcher->paths + watcher->nb_paths, 0, (nb_paths - watcher->nb_paths) * sizeof(char*));
+        watcher->nb_paths = nb_paths;
+    }
+    free(watcher->paths[wd]);
+    watcher->paths[wd] = _strdup(path);
+    watcher->depths[wd] = depth;
+}
+#endif
+
+// ³ֵĿ¼LinuxΪĿ¼Ӽӣ
+// 缯Ŀ¼ǼǼ飨ƶĿ¼entry.jsonѾдã
+static void watch_tree(DirWatcher* watcher, const char* path, int depth) {
+#ifdef __linux__
+    watch_add(watcher, path, depth);
+#endif
+    if (depth == 2) {
+        watch_schedule(watcher, path);
+        return;
+    }
     DIR* dp = opendir(path);
+    char** names;
+    int nb_names;
     if (dp == NULL) {
-        perror("opendir");
         return;
     }
-    while ((entry = readdir(dp))) {
+    list_subdirs(dp, path, &names, &nb_names);
+    closedir(dp);
+    for (int i = 0; i < nb_names; i++) {
         char subPath[1024];
-        snprintf(subPath, sizeof(subPath), "%s/%s", path, entry->d_name);
-        if (stat(subPath, &statbuf) == 0 && S_ISDIR(statbuf.st_mode) && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-            char entryPath[1024];
-            snprintf(entryPath, sizeof(entryPath), "%s/entry.json", subPath);
-
-            char* jsonContent = read_file(entryPath);
-            if (jsonContent) {
-                cJSON* root = cJSON_Parse(jsonContent);
-                if (root == NULL) {
-                    printf("JSONļʧ\n");
-                }
-                else {
-                    cJSON* typeTag = cJSON_GetObjectItem(root, "type_tag");
-                    cJSON* title = cJSON_GetObjectItem(root, "title");
-                    if (typeTag != NULL && cJSON_IsString(typeTag) && title != NULL && cJSON_IsString(title)) {
-                        printf("type_tag: %s\n", typeTag->valuestring);
-                        printf("title: %s\n", title->valuestring);
-
-                        char formatted_title[256];
-                        strncpy_s(formatted_title, sizeof(formatted_title), title->valuestring, _TRUNCATE);
-                        format_filename(formatted_title);
-
-                        char targetDir[1024];
-                        snprintf(targetDir, sizeof(targetDir), "%s/%s", subPath, typeTag->valuestring);
-                        printf("ĿĿ¼: %s\n", targetDir);
-
-                        char audioFile[1024];
-                        char videoFile[1024];
-                        snprintf(audioFile, sizeof(audioFile), "%s/audio.m4s", targetDir);
-                        snprintf(videoFile, sizeof(videoFile), "%s/video.m4s", targetDir);
-
-                        char outputFile[1024];
-                        snprintf(outputFile, sizeof(outputFile), "videotrans/%s.mp4", formatted_title);
-                        printf("ļ: %s\n", outputFile);
-                        merge_audio_video(audioFile, videoFile, outputFile);
-                        printf("ϲ: %s\n", outputFile);
-                    }
-                    else {
-                        printf("δҵtype_tagtitleǩ\n");
-                    }
-                    cJSON_Delete(root);
+        snprintf(subPath, sizeof(subPath), "%s/%s", path, names[i]);
+        watch_tree(watcher, subPath, depth + 1);
+    }
+    free_names(names, nb_names);
+}
+
+// ֹͣӲͷԴ
+void stopWatch(DirWatcher* watcher) {
+#ifdef _WIN32
+    if (watcher->dir != INVALID_HANDLE_VALUE) {
+        CancelIo(watcher->dir);
+        CloseHandle(watcher->dir);
+    }
+    if (watcher->overlapped.hEvent) {
+        CloseHandle(watcher->overlapped.hEvent);
+    }
+#elif defined(__linux__)
+    close(watcher->fd);
+    for (int i = 0; i < watcher->nb_paths; i++) {
+        free(watcher->paths[i]);
+    }
+    free(watcher->paths);
+    free(watcher->depths);
+#endif
+    free(watcher->pending);
+    free(watcher);
+}
+
+// ʼbasePathҪڳɨ֮ǰãɨڼɵزᱻ©
+DirWatcher* startWatch(const char* basePath) {
+    DirWatcher* watcher = (DirWatcher*)calloc(1, sizeof(DirWatcher));
+    if (watcher == NULL) {
+        return NULL;
+    }
+    watcher->basePath = basePath;
+#ifdef _WIN32
+    watcher->dir = CreateFileA(basePath, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    watcher->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (watcher->dir == INVALID_HANDLE_VALUE || watcher->overlapped.hEvent == NULL ||
+        !ReadDirectoryChangesW(watcher->dir, watcher->buffer, sizeof(watcher->buffer), TRUE,
+                               FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE,
+                               NULL, &watcher->overlapped, NULL)) {
+        fprintf(stderr, "޷Ŀ¼ %s\n", basePath);
+        stopWatch(watcher);
+        return NULL;
+    }
+#elif defined(__linux__)
+    watcher->fd = inotify_init1(IN_CLOEXEC);
+    if (watcher->fd < 0) {
+        fprintf(stderr, "޷Ŀ¼ %s: %s\n", basePath, strerror(errno));
+        free(watcher);
+        return NULL;
+    }
+    watch_tree(watcher, basePath, 0);
+#else
+    fprintf(stderr, "ǰƽּ̨֧ģʽ\n");
+    free(watcher);
+    return NULL;
+#endif
+    // ɨᴦеľ缯
+    watcher->nb_pending = 0;
+    signal(SIGINT, watch_signal_handler);
+    signal(SIGTERM, watch_signal_handler);
+    return watcher;
+}
+
+// ȴĿ¼仯ȴtimeout΢
+static void watch_wait(DirWatcher* watcher, int64_t timeout) {
+#ifdef _WIN32
+    if (WaitForSingleObject(watcher->overlapped.hEvent, (DWORD)(timeout / 1000)) != WAIT_OBJECT_0) {
+        return;
+    }
+    DWORD size = 0;
+    if (!GetOverlappedResult(watcher->dir, &watcher->overlapped, &size, FALSE) || size == 0) {
+        // ʧ˲ֱ仯¼о缯
+        watch_tree(watcher, watcher->basePath, 0);
+    }
+    for (uint8_t* p = (uint8_t*)watcher->buffer; size > 0;) {
+        FILE_NOTIFY_INFORMATION* info = (FILE_NOTIFY_INFORMATION*)p;
+        char name[1024], path[1024];
+        DWORD attributes;
+        int len = WideCharToMultiByte(CP_ACP, 0, info->FileName, info->FileNameLength / sizeof(WCHAR),
+                                      name, sizeof(name) - 1, NULL, NULL);
+        name[len] = '\0';
+        int depth = 1;
+        for (char* c = name; *c; c++) {
+            if (*c == '\\') {
+                *c = '/';
+                depth++;
+            }
+        }
+        snprintf(path, sizeof(path), "%s/%s", watcher->basePath, name);
+        if (depth == 3 && strcmp(strrchr(name, '/') + 1, "entry.json") == 0) {
+            *strrchr(path, '/') = '\0';
+            watch_schedule(watcher, path);
+        }
+        else if (depth <= 2 && (info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_RENAMED_NEW_NAME) &&
+                 (attributes = GetFileAttributesA(path)) != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            watch_tree(watcher, path, depth);
+        }
+        if (info->NextEntryOffset == 0) {
+            break;
+        }
+        p += info->NextEntryOffset;
+    }
+    ResetEvent(watcher->overlapped.hEvent);
+    ReadDirectoryChangesW(watcher->dir, watcher->buffer, sizeof(watcher->buffer), TRUE,
+                          FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE,
+                          NULL, &watcher->overlapped, NULL);
+#elif defined(__linux__)
+    struct pollfd pfd = { watcher->fd, POLLIN, 0 };
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    if (poll(&pfd, 1, (int)(timeout / 1000)) <= 0) {
+        return;
+    }
+    ssize_t size = read(watcher->fd, buf, sizeof(buf));
+    for (char* p = buf; size > 0 && p < buf + size;) {
+        struct inotify_event* event = (struct inotify_event*)p;
+        p += sizeof(struct inotify_event) + event->len;
+        if (event->mask & IN_Q_OVERFLOW) {
+            watch_tree(watcher, watcher->basePath, 0);
+            continue;
+        }
+        if (event->wd < 0 || event->wd >= watcher->nb_paths || watcher->paths[event->wd] == NULL) {
+            continue;
+        }
+        if (event->mask & IN_IGNORED) {
+            free(watcher->paths[event->wd]);
+            watcher->paths[event->wd] = NULL;
+            continue;
+        }
+        char path[1024];
+        int depth = watcher->depths[event->wd];
+        snprintf(path, sizeof(path), "%s/%s", watcher->paths[event->wd], event->len ? event->name : "");
+        if (depth < 2 && (event->mask & IN_ISDIR)) {
+            watch_tree(watcher, path, depth + 1);
+        }
+        else if (depth == 2 && event->len && strcmp(event->name, "entry.json") == 0) {
+            watch_schedule(watcher, watcher->paths[event->wd]);
+        }
+    }
+#endif
+}
+
+// entry.jsonжϾ缯ǷѾ
+static int isEpisodeComplete(const char* episodeDir) {
+    char entryPath[1024];
+    int complete = 0;
+    snprintf(entryPath, sizeof(entryPath), "%s/entry.json", episodeDir);
+    char* jsonContent = read_file(entryPath);
+    if (jsonContent == NULL) {
+        return 0;
+    }
+    static const char* const keys[3] = { "is_completed", "downloaded_bytes", "total_bytes" };
+    JsonValue values[3];
+    if (json_find_keys(jsonContent, strlen(jsonContent), keys, values, 3) >= 0) {
+        complete = values[0].type == JSON_TRUE;
+        if (values[1].type == JSON_NUMBER && values[2].type == JSON_NUMBER &&
+            json_get_number(&values[1]) != json_get_number(&values[2])) {
+            complete = 0;
+        }
+        job_free(jsonContent);
+        return complete;
+    }
+    cJSON* root = cJSON_Parse(jsonContent);
+    if (root) {
+        cJSON* completed = cJSON_GetObjectItem(root, "is_completed");
+        cJSON* downloaded = cJSON_GetObjectItem(root, "downloaded_bytes");
+        cJSON* total = cJSON_GetObjectItem(root, "total_bytes");
+        complete = cJSON_IsTrue(completed);
+        if (cJSON_IsNumber(downloaded) && cJSON_IsNumber(total) && downloaded->valuedouble != total->valuedouble) {
+            complete = 0;
+        }
+        cJSON_Delete(root);
+    }
+    job_free(jsonContent);
+    return complete;
+}
+
+// ѭյSIGINT/SIGTERM󷵻ء缯ڷ飬
+// ɵĽparseEpisodeûб仯Ļᱻ嵥תеԺٲ
+void runWatch(DirWatcher* watcher, JobPool* pool) {
+    Arena arena = { 0 };
+    setThreadArena(&arena);
+    printf("ʼ %sCtrl+C˳\n", watcher->basePath);
+    while (!watch_stop) {
+        int64_t now = av_gettime_relative();
+        int64_t timeout = AV_TIME_BASE;
+        for (int i = 0; i < watcher->nb_pending;) {
+            PendingEpisode* episode = &watcher->pending[i];
+            if (episode->due > now) {
+                timeout = FFMIN(timeout, episode->due - now);
+                i++;
+                continue;
+            }
+            if (isJobInflight(pool, episode->path)) {
+                episode->due = now + WATCH_DEBOUNCE;
+                i++;
+                continue;
+            }
+            if (isEpisodeComplete(episode->path)) {
+                printf(": %s\n", episode->path);
+                int64_t start = thread_trace ? av_gettime_relative() : 0;
+                parseEpisode(episode->path, pool, NULL);
+                if (thread_trace) {
+                    traceSpan("parse", "parse", episode->path, start, av_gettime_relative());
                 }
-                free(jsonContent);
             }
+            arena_reset(&arena);
+            *episode = watcher->pending[--watcher->nb_pending];
         }
+        watch_wait(watcher, timeout);
     }
-    closedir(dp);
+    printf("ֹͣ\n");
+    setThreadArena(NULL);
+    arena_free(&arena);
 }
 
 
-int main() {
+int main(int argc, char** argv) {
     setlocale(LC_ALL, "zh_CN.UTF-8");
 #ifdef _WIN32
     SetConsoleOutputCP(CP_UTF8);
 #endif
 
-    DynamicArray* folders = createArray(INITIAL_SIZE);
+    int nb_workers = 0, nb_scan_threads = 0;
+    int incremental = 1, force = 0, dedup = 0, watch = 0, use_scan_cache = 1;
+    const char* reportPath = NULL, * tracePath = NULL;
+    const char* metricsPath = NULL;
+    double progressInterval = 0;
+    MergeOptions options = { 0 };
+    options.fast_probe = 1;
+    options.engine = MERGE_ENGINE_LAVF;
+    options.prefetch_budget = DEFAULT_PREFETCH_BUDGET;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            nb_workers = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-scanj") == 0 && i + 1 < argc) {
+            nb_scan_threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-fullprobe") == 0) {
+            options.fast_probe = 0;
+        }
+        else if (strcmp(argv[i], "-engine") == 0 && i + 1 < argc && strcmp(argv[i + 1], "box") == 0) {
+            options.engine = MERGE_ENGINE_BOX;
+            i++;
+        }
+        else if (strcmp(argv[i], "-engine") == 0 && i + 1 < argc && strcmp(argv[i + 1], "lavf") == 0) {
+            options.engine = MERGE_ENGINE_LAVF;
+            i++;
+        }
+        else if (strcmp(argv[i], "-frag") == 0 && i + 1 < argc) {
+            options.frag_duration = (int64_t)(atof(argv[++i]) * AV_TIME_BASE);
+        }
+        else if (strcmp(argv[i], "-faststart") == 0) {
+            options.faststart = FASTSTART_RESERVE;
+        }
+        else if (strcmp(argv[i], "-force") == 0) {
+            force = 1;
+        }
+        else if (strcmp(argv[i], "-nomanifest") == 0) {
+            incremental = 0;
+        }
+        else if (strcmp(argv[i], "-dedup") == 0) {
+            dedup = 1;
+        }
+        else if (strcmp(argv[i], "-watch") == 0) {
+            watch = 1;
+        }
+        else if (strcmp(argv[i], "-noscancache") == 0) {
+            use_scan_cache = 0;
+        }
+        else if (strcmp(argv[i], "-dryrun") == 0) {
+            options.dry_run = 1;
+        }
+        else if (strcmp(argv[i], "-report") == 0 && i + 1 < argc) {
+            reportPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "-progress") == 0 && i + 1 < argc) {
+            progressInterval = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-metrics") == 0 && i + 1 < argc) {
+            metricsPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "-prefetch") == 0 && i + 1 < argc) {
+            options.prefetch_budget = (int64_t)(atof(argv[++i]) * (1 << 20));
+        }
+        else {
+            fprintf(stderr, "÷: %s [-j ߳] [-scanj ɨ߳] [-fullprobe] [-engine lavf|box] [-frag Ƭ] [-faststart] [-force] [-nomanifest] [-dedup] [-watch] [-noscancache] [-dryrun] [-report ļ] [-trace ʱļ] [-progress ] [-metrics ָļ] [-prefetch ԤMB]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // cJSONĽڵӵǰ̵߳ڴط
+    cJSON_Hooks hooks = { job_malloc, job_free };
+    cJSON_InitHooks(&hooks);
+
+    if (tracePath) {
+        if (startTrace() < 0) {
+            fprintf(stderr, "ڴʧ\n");
+            return 1;
+        }
+        // ģʽ߳Ҳ缯
+        beginThreadTrace("main");
+    }
+    Manifest* manifest = incremental ? openManifest(MANIFEST_PATH) : NULL;
+    RunStats* stats = reportPath ? createRunStats() : NULL;
+    // ߳ʱȡýȲλ߳Ҫ
+    if (nb_workers <= 0) {
+        nb_workers = av_cpu_count();
+    }
+    if ((progressInterval > 0 || metricsPath) &&
+        startProgress(nb_workers, (int64_t)(progressInterval * AV_TIME_BASE), metricsPath) < 0) {
+        fprintf(stderr, "޷\n");
+    }
+    JobPool pool;
+    if (startJobPool(&pool, nb_workers, &options, manifest, force, dedup, stats) < 0) {
+        finishProgress();
+        if (manifest) {
+            closeManifest(manifest);
+        }
+        if (stats) {
+            freeRunStats(stats);
+        }
+        return 1;
+    }
+    printf("߳: %d\n", pool.nb_workers);
+    pool.onlyComplete = watch;
+    setProgressQueue(PROGRESS_QUEUE_JOB, pool.queue);
+
+    PathPool* paths = createPathPool();
+    if (paths == NULL) {
+        fprintf(stderr, "ڴʧ\n");
+        finishJobPool(&pool);
+        finishProgress();
+        if (manifest) {
+            closeManifest(manifest);
+        }
+        if (stats) {
+            freeRunStats(stats);
+        }
+        return 1;
+    }
+    DynamicArray* folders = createPathArray(INITIAL_SIZE, paths);
     int vid_num = 0;
     char basePath[] = "bilibili_video";
 
-    traverseDirectory(basePath, folders);
+    DirWatcher* watcher = NULL;
+    if (watch && (watcher = startWatch(basePath)) == NULL) {
+        finishJobPool(&pool);
+        finishProgress();
+        if (manifest) {
+            closeManifest(manifest);
+        }
+        if (stats) {
+            freeRunStats(stats);
+        }
+        freeArray(folders);
+        freePathPool(paths);
+        return 1;
+    }
+
+    ScanCache* cache = use_scan_cache ? loadScanCache(SCAN_CACHE_PATH, basePath) : NULL;
+    Pipeline pipeline;
+    if (startPipeline(&pipeline, basePath, folders, &pool, nb_scan_threads, cache, paths) == 0) {
+        finishPipeline(&pipeline);
+        if (watcher == NULL) {
+            endProgressScan();
+        }
+        if (stats) {
+            stats->scan_time = pipeline.scanTime;
+        }
+        if (cache && saveScanCache(cache, SCAN_CACHE_PATH) < 0) {
+            fprintf(stderr, "޷дɨ軺 %s\n", SCAN_CACHE_PATH);
+        }
+    }
+    if (cache) {
+        freeScanCache(cache);
+    }
+    if (watcher) {
+        runWatch(watcher, &pool);
+        stopWatch(watcher);
+    }
+    int failed = finishJobPool(&pool);
+    finishProgress();
+    if (manifest) {
+        closeManifest(manifest);
+    }
+    if (stats) {
+        if (writeRunReport(stats, reportPath, pool.nb_workers, pool.skipped) < 0) {
+            fprintf(stderr, "޷дб %s\n", reportPath);
+        }
+        freeRunStats(stats);
+    }
+    if (tracePath && finishTrace(tracePath) < 0) {
+        fprintf(stderr, "޷дʱ %s\n", tracePath);
+    }
     vid_num = folders->size;
 
     printf("Number of folders: %d\n", vid_num);
@@ -399,7 +6068,9 @@ int main() {
     }
 
     freeArray(folders);
-    return 0;
+    freePathPool(paths);
+    // ϲʧʱط㣬ڽűж
+    return failed > 0 ? 1 : 0;
 }
 
 
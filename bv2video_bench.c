@@ -0,0 +1,1040 @@
+// bv2videoܲԣģbilibiliͻĿ¼ĲݣȻbv2videoתͳƺʱ
+// libavcodecԴımpeg4ƵaacƵΪֶMP4m4s
+// Ŀ¼ṹͻͬbilibili_video/<avid>/c_<cid>/entry.json  <type_tag>/audio.m4svideo.m4s
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <direct.h>
+#else
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#endif
+#ifdef __linux__
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#endif
+#include "dirent.h"
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <libavutil/time.h>
+#include <libavutil/channel_layout.h>
+#include <locale.h>
+
+#ifdef _WIN32
+#define make_dir(path) _mkdir(path)
+#else
+#define make_dir(path) mkdir((path), 0755)
+#endif
+
+// Բ
+typedef struct {
+    const char* bin;        // bv2videoִļ
+    const char* dir;        // Ŀ¼bv2video
+    const char* args;       // bv2videoĲ
+    const char* report;     // JSONļΪNULLʱ׼
+    int episodes;
+    int variants;           // ͬݵľ缯缯ЩݣΪ0ʱÿ缯
+    double duration;        // ÿ缯ʱ룩
+    int width;
+    int height;
+    int fps;
+    int64_t video_bitrate;
+    int64_t audio_bitrate;
+    int runs;
+    int regen;              // ɲ
+    int gen_only;           // ֻɲ
+    int meta_only;          // ֻentry.jsonm4sΪļ
+} BenchConfig;
+
+// һеĽ
+typedef struct {
+    double wall;
+    double user;
+    double sys;
+    int64_t peak_rss_kb;
+    int64_t output_bytes;
+    int exit_code;
+    double scan;            // bv2videoɨʱûʱΪ-1
+    double parse;           // bv2videoĽʱûʱΪ-1
+} BenchRun;
+
+// ͳƵϵͳ
+typedef struct {
+    const char* name;
+    long nr;
+    int64_t count;
+} SyscallCount;
+
+#define MAX_SYSCALL_COUNTS 16
+typedef struct {
+    int64_t total;          // Ϊ-1ʱʾ֧ͳ
+    SyscallCount calls[MAX_SYSCALL_COUNTS];
+    int nb_calls;
+} SyscallStats;
+
+static int64_t parse_bitrate(const char* str) {
+    char* end;
+    double v = strtod(str, &end);
+    if (*end == 'k' || *end == 'K') {
+        v *= 1000;
+    }
+    else if (*end == 'm' || *end == 'M') {
+        v *= 1000000;
+    }
+    return (int64_t)v;
+}
+
+// 𼶴Ŀ¼
+static int make_dirs(const char* path) {
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "%s", path);
+    for (char* p = buf + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (make_dir(buf) != 0 && errno != EEXIST) {
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+    return make_dir(buf) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+static int64_t file_size(const char* path) {
+    struct stat statbuf;
+    return stat(path, &statbuf) == 0 ? (int64_t)statbuf.st_size : -1;
+}
+
+static int copy_file(const char* src, const char* dst) {
+    FILE* in = fopen(src, "rb");
+    FILE* out = in ? fopen(dst, "wb") : NULL;
+    char buf[1 << 16];
+    size_t n;
+    int ret = in && out ? 0 : -1;
+    while (ret == 0 && (n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) {
+            ret = -1;
+        }
+    }
+    if (in) {
+        fclose(in);
+    }
+    if (out && fclose(out) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+// ɲԻ棺֡ƶĽαʹܴﵽ趨
+static void fill_video_frame(AVFrame* frame, int index, unsigned int* seed) {
+    for (int y = 0; y < frame->height; y++) {
+        uint8_t* row = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < frame->width; x++) {
+            *seed = *seed * 1103515245u + 12345u;
+            row[x] = (uint8_t)(x + y + index * 3 + ((*seed >> 16) & 0x1f));
+        }
+    }
+    for (int plane = 1; plane < 3; plane++) {
+        for (int y = 0; y < frame->height / 2; y++) {
+            uint8_t* row = frame->data[plane] + y * frame->linesize[plane];
+            for (int x = 0; x < frame->width / 2; x++) {
+                row[x] = (uint8_t)(128 + ((x * plane + y + index) & 0x3f));
+            }
+        }
+    }
+}
+
+static void fill_audio_frame(AVFrame* frame, int64_t pts, unsigned int* seed) {
+    for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
+        float* samples = (float*)frame->data[ch];
+        for (int i = 0; i < frame->nb_samples; i++) {
+            int64_t t = pts + i;
+            *seed = *seed * 1103515245u + 12345u;
+            // ݲ
+            samples[i] = 0.3f * (float)((t * (220 + ch * 110)) % frame->sample_rate) / frame->sample_rate - 0.15f +
+                0.02f * (float)((int)(*seed >> 16 & 0xff) - 128) / 128;
+        }
+    }
+}
+
+static int encode_and_write(AVFormatContext* oc, AVStream* st, AVCodecContext* enc, AVFrame* frame, AVPacket* pkt) {
+    int ret = avcodec_send_frame(enc, frame);
+    while (ret >= 0) {
+        ret = avcodec_receive_packet(enc, pkt);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            return 0;
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        av_packet_rescale_ts(pkt, enc->time_base, st->time_base);
+        pkt->stream_index = st->index;
+        ret = av_interleaved_write_frame(oc, pkt);
+    }
+    return ret;
+}
+
+// һֶMP4ļֻһ·ƵƵͻصm4sṹͬ
+static int write_m4s(const char* filename, int is_video, const BenchConfig* config, unsigned int seed) {
+    AVFormatContext* oc = NULL;
+    AVCodecContext* enc = NULL;
+    AVFrame* frame = NULL;
+    AVPacket* pkt = NULL;
+    AVDictionary* opts = NULL;
+    AVStream* st;
+    int ret;
+
+    const AVCodec* codec = avcodec_find_encoder(is_video ? AV_CODEC_ID_MPEG4 : AV_CODEC_ID_AAC);
+    if (codec == NULL) {
+        fprintf(stderr, "Ҳ\n");
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+    if ((ret = avformat_alloc_output_context2(&oc, NULL, "mp4", filename)) < 0) {
+        return ret;
+    }
+    enc = avcodec_alloc_context3(codec);
+    frame = av_frame_alloc();
+    pkt = av_packet_alloc();
+    st = avformat_new_stream(oc, NULL);
+    if (enc == NULL || frame == NULL || pkt == NULL || st == NULL) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if (is_video) {
+        enc->width = config->width;
+        enc->height = config->height;
+        enc->pix_fmt = AV_PIX_FMT_YUV420P;
+        enc->time_base = (AVRational){ 1, config->fps };
+        enc->framerate = (AVRational){ config->fps, 1 };
+        enc->gop_size = config->fps * 2;
+        enc->max_b_frames = 2;
+        enc->bit_rate = config->video_bitrate;
+    }
+    else {
+        enc->sample_rate = 48000;
+        enc->sample_fmt = AV_SAMPLE_FMT_FLTP;
+        enc->time_base = (AVRational){ 1, enc->sample_rate };
+        enc->bit_rate = config->audio_bitrate;
+        av_channel_layout_copy(&enc->ch_layout, &(AVChannelLayout)AV_CHANNEL_LAYOUT_STEREO);
+    }
+    if (oc->oformat->flags & AVFMT_GLOBALHEADER) {
+        enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    if ((ret = avcodec_open2(enc, codec, NULL)) < 0 ||
+        (ret = avcodec_parameters_from_context(st->codecpar, enc)) < 0) {
+        goto end;
+    }
+    st->time_base = enc->time_base;
+
+    frame->format = is_video ? enc->pix_fmt : enc->sample_fmt;
+    frame->width = enc->width;
+    frame->height = enc->height;
+    frame->nb_samples = is_video ? 0 : enc->frame_size;
+    frame->sample_rate = enc->sample_rate;
+    if ((ret = av_channel_layout_copy(&frame->ch_layout, &enc->ch_layout)) < 0 ||
+        (ret = av_frame_get_buffer(frame, 0)) < 0) {
+        goto end;
+    }
+
+    if ((ret = avio_open(&oc->pb, filename, AVIO_FLAG_WRITE)) < 0) {
+        goto end;
+    }
+    // ͻ˵m4sԹؼ֡ƬtfdtfMP4
+    av_dict_set(&opts, "movflags", "+frag_keyframe+empty_moov+default_base_moof", 0);
+    if ((ret = avformat_write_header(oc, &opts)) < 0) {
+        goto end;
+    }
+
+    int64_t total = is_video ? (int64_t)(config->duration * config->fps) : (int64_t)(config->duration * enc->sample_rate);
+    for (int64_t pts = 0, index = 0; pts < total; index++) {
+        if ((ret = av_frame_make_writable(frame)) < 0) {
+            goto end;
+        }
+        if (is_video) {
+            fill_video_frame(frame, (int)index, &seed);
+            frame->pts = pts++;
+        }
+        else {
+            fill_audio_frame(frame, pts, &seed);
+            frame->pts = pts;
+            pts += frame->nb_samples;
+        }
+        if ((ret = encode_and_write(oc, st, enc, frame, pkt)) < 0) {
+            goto end;
+        }
+    }
+    if ((ret = encode_and_write(oc, st, enc, NULL, pkt)) < 0) {
+        goto end;
+    }
+    ret = av_write_trailer(oc);
+
+end:
+    av_dict_free(&opts);
+    av_packet_free(&pkt);
+    av_frame_free(&frame);
+    avcodec_free_context(&enc);
+    if (oc) {
+        avio_closep(&oc->pb);
+        avformat_free_context(oc);
+    }
+    return ret;
+}
+
+static int write_entry_json(const char* path, int avid, int cid, int index, int64_t total_bytes, const BenchConfig* config) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    // ֶͻɵentry.jsonһ£page_dataн϶ת޹ص
+    fprintf(file,
+            "{\"media_type\":2,\"has_dash_audio\":true,\"is_completed\":true,"
+            "\"total_bytes\":%lld,\"downloaded_bytes\":%lld,"
+            "\"title\":\"׼Ƶ %d\",\"type_tag\":\"64\",\"cover\":\"http://i0.hdslb.com/bfs/archive/bench%d.jpg\","
+            "\"video_quality\":64,\"prefered_video_quality\":64,\"guessed_total_bytes\":0,"
+            "\"total_time_milli\":%lld,\"danmaku_count\":1000,\"time_update_stamp\":1700000000000,"
+            "\"time_create_stamp\":1700000000000,\"can_play_in_advance\":true,\"interrupt_transform_temp_file\":false,"
+            "\"quality_pithy_description\":\"720P\",\"quality_superscript\":\"\",\"cache_version_code\":7000000,"
+            "\"preferred_audio_quality\":0,\"audio_quality\":0,\"avid\":%d,\"spid\":0,\"seasion_id\":0,\"bvid\":\"BV1bench%05d\","
+            "\"owner_id\":1,\"owner_name\":\"bench\",\"is_charge_video\":false,\"verification_code\":0,"
+            "\"page_data\":{\"cid\":%d,\"page\":%d,\"from\":\"vupload\",\"part\":\"%d\",\"link\":\"\","
+            "\"vid\":\"\",\"has_alias\":false,\"tid\":0,\"width\":%d,\"height\":%d,\"rotate\":0,"
+            "\"download_title\":\"Ƶѻ\",\"download_subtitle\":\"׼Ƶ %d\"}}",
+            (long long)total_bytes, (long long)total_bytes, index + 1, avid, (long long)(config->duration * 1000),
+            avid, avid, cid, index + 1, index + 1, config->width, config->height, index + 1);
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+// ɲĿ¼ÿƵĿ¼з4缯
+static int generate_tree(const BenchConfig* config, int64_t* input_bytes) {
+    char path[1024], episodeDir[1024], audio[1024], video[1024];
+    *input_bytes = 0;
+    for (int i = 0; i < config->episodes; i++) {
+        int avid = 100000 + i / 4, cid = 200000 + i;
+        snprintf(episodeDir, sizeof(episodeDir), "%s/bilibili_video/%d/c_%d", config->dir, avid, cid);
+        snprintf(path, sizeof(path), "%s/64", episodeDir);
+        if (make_dirs(path) < 0) {
+            fprintf(stderr, "޷Ŀ¼ %s\n", path);
+            return -1;
+        }
+        snprintf(audio, sizeof(audio), "%s/audio.m4s", path);
+        snprintf(video, sizeof(video), "%s/video.m4s", path);
+        if (config->variants > 0 && i >= config->variants) {
+            // ǰɵ
+            int src = i % config->variants;
+            char srcAudio[1024], srcVideo[1024];
+            snprintf(srcAudio, sizeof(srcAudio), "%s/bilibili_video/%d/c_%d/64/audio.m4s", config->dir, 100000 + src / 4, 200000 + src);
+            snprintf(srcVideo, sizeof(srcVideo), "%s/bilibili_video/%d/c_%d/64/video.m4s", config->dir, 100000 + src / 4, 200000 + src);
+            if (copy_file(srcAudio, audio) < 0 || copy_file(srcVideo, video) < 0) {
+                fprintf(stderr, "޷Ʋݵ %s\n", path);
+                return -1;
+            }
+        }
+        else if (config->meta_only) {
+            // ɨͽȡm4sֻļ
+            FILE* stub;
+            if ((stub = fopen(audio, "wb")) == NULL || fclose(stub) != 0 ||
+                (stub = fopen(video, "wb")) == NULL || fclose(stub) != 0) {
+                fprintf(stderr, "޷ %s\n", path);
+                return -1;
+            }
+        }
+        else if (write_m4s(audio, 0, config, 1234u + i) < 0 || write_m4s(video, 1, config, 5678u + i) < 0) {
+            fprintf(stderr, "޷ɲ %s\n", path);
+            return -1;
+        }
+        int64_t bytes = file_size(audio) + file_size(video);
+        snprintf(path, sizeof(path), "%s/entry.json", episodeDir);
+        if (write_entry_json(path, avid, cid, i, bytes, config) < 0) {
+            fprintf(stderr, "޷д %s\n", path);
+            return -1;
+        }
+        *input_bytes += bytes;
+        if (!config->meta_only || (i + 1) % 1000 == 0 || i + 1 == config->episodes) {
+            printf("\rɲ %d/%d", i + 1, config->episodes);
+            fflush(stdout);
+        }
+    }
+    printf("\n");
+    return 0;
+}
+
+// ͳвݵĴСݲʱ-1
+static int64_t tree_input_bytes(const BenchConfig* config) {
+    char path[1024];
+    int64_t total = 0;
+    for (int i = 0; i < config->episodes; i++) {
+        for (int j = 0; j < 2; j++) {
+            snprintf(path, sizeof(path), "%s/bilibili_video/%d/c_%d/64/%s.m4s", config->dir, 100000 + i / 4, 200000 + i,
+                     j ? "video" : "audio");
+            int64_t size = file_size(path);
+            if (size < 0) {
+                return -1;
+            }
+            total += size;
+        }
+    }
+    return total;
+}
+
+// Ŀ¼嵥ɨ軺棩ǰļܴС
+static int64_t clean_output(const BenchConfig* config) {
+    char dirPath[1024], path[1024];
+    int64_t total = 0;
+    struct dirent* entry;
+    snprintf(dirPath, sizeof(dirPath), "%s/videotrans", config->dir);
+    DIR* dp = opendir(dirPath);
+    if (dp == NULL) {
+        make_dirs(dirPath);
+        return 0;
+    }
+    while ((entry = readdir(dp))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dirPath, entry->d_name);
+        size_t len = strlen(entry->d_name);
+        if (len > 4 && strcmp(entry->d_name + len - 4, ".mp4") == 0) {
+            total += FFMAX(file_size(path), 0);
+        }
+        remove(path);
+    }
+    closedir(dp);
+    return total;
+}
+
+#ifdef __linux__
+// ֱͳƴϵͳãֻ
+static const struct {
+    const char* name;
+    long nr;
+} traced_syscalls[] = {
+#ifdef SYS_open
+    { "open", SYS_open },
+#endif
+    { "openat", SYS_openat },
+    { "close", SYS_close },
+    { "getdents64", SYS_getdents64 },
+#ifdef SYS_stat
+    { "stat", SYS_stat },
+#endif
+#ifdef SYS_newfstatat
+    { "newfstatat", SYS_newfstatat },
+#endif
+#ifdef SYS_statx
+    { "statx", SYS_statx },
+#endif
+    { "fstat", SYS_fstat },
+    { "read", SYS_read },
+    { "write", SYS_write },
+    { "mmap", SYS_mmap },
+    { "brk", SYS_brk },
+    { "futex", SYS_futex },
+};
+
+static void count_syscall(SyscallStats* stats, long nr) {
+    stats->total++;
+    for (int i = 0; i < stats->nb_calls; i++) {
+        if (stats->calls[i].nr == nr) {
+            stats->calls[i].count++;
+            break;
+        }
+    }
+}
+
+// ӽ̵ֱ߳ȫ˳ͳϵͳô
+static int trace_child(pid_t pid, SyscallStats* stats, int* status, struct rusage* usage) {
+    int st;
+    int64_t stops = 0;
+    // ӽexecv֮ͣ
+    if (waitpid(pid, &st, 0) < 0 || !WIFSTOPPED(st)) {
+        return -1;
+    }
+    ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, pid, 0, 0);
+    for (;;) {
+        struct rusage ru;
+        pid_t tid = wait4(-1, &st, __WALL, &ru);
+        if (tid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (WIFEXITED(st) || WIFSIGNALED(st)) {
+            if (tid == pid) {
+                *status = st;
+                *usage = ru;
+            }
+            continue;
+        }
+        int sig = WSTOPSIG(st), inject = 0;
+        if (sig == (SIGTRAP | 0x80)) {
+#ifdef PTRACE_GET_SYSCALL_INFO
+            struct __ptrace_syscall_info info;
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) > 0) {
+                if (info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+                    count_syscall(stats, (long)info.entry.nr);
+                }
+            }
+            else
+#endif
+            {
+                // ں˲֧ʱֻͳ˳ͣһ
+                stops++;
+            }
+        }
+        else if (sig != SIGTRAP && sig != SIGSTOP) {
+            // SIGTRAPclone¼SIGSTOP̵߳ĳʼֹͣźתӽ
+            inject = sig;
+        }
+        ptrace(PTRACE_SYSCALL, tid, 0, inject);
+    }
+    stats->total += stops / 2;
+    return 0;
+}
+#endif
+
+// bv2videoı׼жȡɨͽʱfinishPipeline()stage_timesУ
+static void read_stage_times(const char* logPath, BenchRun* run) {
+    char line[1024];
+    int episodes;
+    FILE* file = fopen(logPath, "r");
+    run->scan = run->parse = -1;
+    if (file == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "stage_times scan_s=%lf parse_s=%lf episodes=%d", &run->scan, &run->parse, &episodes) == 3) {
+            break;
+        }
+        run->scan = run->parse = -1;
+    }
+    fclose(file);
+}
+
+// ڲĿ¼øһbv2videostatsΪNULLʱͳϵͳôֻ֧Linux
+// ٻУͳƵһεʱ
+static int run_bv2video(const BenchConfig* config, const char* cmdArgs, BenchRun* run, SyscallStats* stats) {
+    char logPath[1024];
+    memset(run, 0, sizeof(*run));
+    snprintf(logPath, sizeof(logPath), "%s/bench.log", config->dir);
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+        stats->total = -1;
+    }
+
+#ifdef _WIN32
+    char bin[MAX_PATH], cmdline[2048];
+    STARTUPINFOA si = { sizeof(si) };
+    PROCESS_INFORMATION pi;
+    PROCESS_MEMORY_COUNTERS pmc = { sizeof(pmc) };
+    SECURITY_ATTRIBUTES sa = { sizeof(sa), NULL, TRUE };
+    FILETIME create_time, exit_time, kernel_time, user_time;
+    DWORD exit_code = 0;
+    _fullpath(bin, config->bin, sizeof(bin));
+    snprintf(cmdline, sizeof(cmdline), "\"%s\" %s", bin, cmdArgs);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdOutput = CreateFileA("NUL", GENERIC_WRITE, FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, NULL);
+    si.hStdError = CreateFileA(logPath, GENERIC_WRITE, FILE_SHARE_READ, &sa, CREATE_ALWAYS, 0, NULL);
+    int64_t start = av_gettime_relative();
+    if (!CreateProcessA(NULL, cmdline, NULL, NULL, TRUE, 0, NULL, config->dir, &si, &pi)) {
+        fprintf(stderr, "޷ %s\n", bin);
+        CloseHandle(si.hStdOutput);
+        CloseHandle(si.hStdError);
+        return -1;
+    }
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    run->wall = (av_gettime_relative() - start) / 1e6;
+    GetExitCodeProcess(pi.hProcess, &exit_code);
+    if (GetProcessTimes(pi.hProcess, &create_time, &exit_time, &kernel_time, &user_time)) {
+        run->user = (((int64_t)user_time.dwHighDateTime << 32) | user_time.dwLowDateTime) / 1e7;
+        run->sys = (((int64_t)kernel_time.dwHighDateTime << 32) | kernel_time.dwLowDateTime) / 1e7;
+    }
+    if (GetProcessMemoryInfo(pi.hProcess, &pmc, sizeof(pmc))) {
+        run->peak_rss_kb = pmc.PeakWorkingSetSize / 1024;
+    }
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    CloseHandle(si.hStdOutput);
+    CloseHandle(si.hStdError);
+    run->exit_code = (int)exit_code;
+#else
+    char bin[PATH_MAX], args[1024];
+    char* argv[64];
+    int argc = 0;
+    struct rusage usage;
+    int status = 0;
+    if (realpath(config->bin, bin) == NULL) {
+        fprintf(stderr, "Ҳ %s\n", config->bin);
+        return -1;
+    }
+    snprintf(args, sizeof(args), "%s", cmdArgs);
+    argv[argc++] = bin;
+    for (char* tok = strtok(args, " "); tok && argc < 63; tok = strtok(NULL, " ")) {
+        argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+#ifndef __linux__
+    stats = NULL;
+#endif
+
+    int64_t start = av_gettime_relative();
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        int log_fd = open(logPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (chdir(config->dir) != 0) {
+            _exit(127);
+        }
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(log_fd >= 0 ? log_fd : null_fd, STDERR_FILENO);
+#ifdef __linux__
+        if (stats && ptrace(PTRACE_TRACEME, 0, 0, 0) < 0) {
+            _exit(127);
+        }
+#endif
+        execv(bin, argv);
+        _exit(127);
+    }
+#ifdef __linux__
+    if (stats) {
+        stats->total = 0;
+        for (int i = 0; i < (int)FF_ARRAY_ELEMS(traced_syscalls) && i < MAX_SYSCALL_COUNTS; i++) {
+            stats->calls[i].name = traced_syscalls[i].name;
+            stats->calls[i].nr = traced_syscalls[i].nr;
+            stats->nb_calls++;
+        }
+        if (trace_child(pid, stats, &status, &usage) < 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            return -1;
+        }
+    }
+    else
+#endif
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        return -1;
+    }
+    run->wall = (av_gettime_relative() - start) / 1e6;
+    run->user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    run->sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    run->peak_rss_kb = usage.ru_maxrss;
+    run->exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+#endif
+    read_stage_times(logPath, run);
+    return 0;
+}
+
+// Ŀ¼һת
+static int run_once(const BenchConfig* config, BenchRun* run) {
+    clean_output(config);
+    if (run_bv2video(config, config->args, run, NULL) < 0) {
+        return -1;
+    }
+    run->output_bytes = clean_output(config);
+    return 0;
+}
+
+static int compare_wall(const void* a, const void* b) {
+    double x = ((const BenchRun*)a)->wall, y = ((const BenchRun*)b)->wall;
+    return x < y ? -1 : x > y;
+}
+
+// дJSONַתšбܺͿַ
+static void json_print_string(FILE* file, const char* str) {
+    fputc('"', file);
+    for (const unsigned char* p = (const unsigned char*)str; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(file, "\\%c", *p);
+        }
+        else if (*p < 0x20) {
+            fprintf(file, "\\u%04x", *p);
+        }
+        else {
+            fputc(*p, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void write_run_json(FILE* out, const BenchRun* run, const BenchConfig* config, int64_t input_bytes) {
+    fprintf(out, "{\"wall_s\": %.3f, \"user_s\": %.3f, \"sys_s\": %.3f, \"cpu_s\": %.3f, \"peak_rss_kb\": %lld, "
+            "\"episodes_per_s\": %.3f, \"mb_per_s\": %.3f, \"output_bytes\": %lld, \"exit_code\": %d}",
+            run->wall, run->user, run->sys, run->user + run->sys, (long long)run->peak_rss_kb,
+            run->wall > 0 ? config->episodes / run->wall : 0, run->wall > 0 ? input_bytes / 1e6 / run->wall : 0,
+            (long long)run->output_bytes, run->exit_code);
+}
+
+static void write_report(FILE* out, const BenchConfig* config, int64_t input_bytes, BenchRun* runs) {
+    fprintf(out, "{\n  \"benchmark\": \"convert\",\n  \"args\": ");
+    json_print_string(out, config->args);
+    fprintf(out, ",\n");
+    fprintf(out, "  \"episodes\": %d,\n  \"variants\": %d,\n  \"duration_s\": %.3f,\n  \"video\": \"%dx%d@%d\",\n",
+            config->episodes, config->variants, config->duration, config->width, config->height, config->fps);
+    fprintf(out, "  \"video_bitrate\": %lld,\n  \"audio_bitrate\": %lld,\n  \"input_bytes\": %lld,\n  \"runs\": [\n",
+            (long long)config->video_bitrate, (long long)config->audio_bitrate, (long long)input_bytes);
+    for (int i = 0; i < config->runs; i++) {
+        fprintf(out, "    ");
+        write_run_json(out, &runs[i], config, input_bytes);
+        fprintf(out, "%s\n", i + 1 < config->runs ? "," : "");
+    }
+    qsort(runs, config->runs, sizeof(BenchRun), compare_wall);
+    fprintf(out, "  ],\n  \"best\": ");
+    write_run_json(out, &runs[0], config, input_bytes);
+    fprintf(out, ",\n  \"median\": ");
+    write_run_json(out, &runs[config->runs / 2], config, input_bytes);
+    fprintf(out, "\n}\n");
+}
+
+#ifdef __linux__
+// ļҳ
+static void fadvise_tree(const char* path) {
+    char subPath[1024];
+    struct dirent* entry;
+    DIR* dp = opendir(path);
+    if (dp == NULL) {
+        return;
+    }
+    while ((entry = readdir(dp))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        snprintf(subPath, sizeof(subPath), "%s/%s", path, entry->d_name);
+        if (entry->d_type == DT_DIR) {
+            fadvise_tree(subPath);
+            continue;
+        }
+        int fd = open(subPath, O_RDONLY);
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+    closedir(dp);
+}
+#endif
+
+// ҳ棬仺ԡʹõķ֧ʱNULL
+static const char* drop_page_cache(const char* dir) {
+#ifdef __linux__
+    // ҪrootȨޣûȨʱֻļݻ棬Ŀ¼inodeȻ
+    sync();
+    FILE* file = fopen("/proc/sys/vm/drop_caches", "w");
+    if (file) {
+        int ok = fputs("3", file) >= 0;
+        if (fclose(file) == 0 && ok) {
+            return "drop_caches";
+        }
+    }
+    fadvise_tree(dir);
+    return "fadvise";
+#else
+    (void)dir;
+    return NULL;
+#endif
+}
+
+// ģеһзʽ
+typedef struct {
+    const char* name;
+    const char* args;       // Ӹbv2videoĲ
+    int cold;               // ÿǰҳ
+    int prime;              // ǰһΣɨ軺
+    int count_syscalls;
+} ScaleMode;
+
+static const ScaleMode scale_modes[] = {
+    { "cold", "-noscancache", 1, 0, 0 },
+    { "warm", "-noscancache", 0, 0, 1 },
+    { "scancache", "", 0, 1, 1 },
+};
+
+static void write_syscalls_json(FILE* out, const SyscallStats* stats) {
+    fprintf(out, "{\"total\": %lld", (long long)stats->total);
+    for (int i = 0; i < stats->nb_calls; i++) {
+        fprintf(out, ", \"%s\": %lld", stats->calls[i].name, (long long)stats->calls[i].count);
+    }
+    fprintf(out, "}");
+}
+
+static void write_scale_run_json(FILE* out, const BenchRun* run, int episodes, int64_t baseline_rss_kb) {
+    fprintf(out, "{\"wall_s\": %.3f, \"scan_s\": %.3f, \"parse_s\": %.3f, \"user_s\": %.3f, \"sys_s\": %.3f, "
+            "\"peak_rss_kb\": %lld, \"bytes_per_episode\": %.1f, \"episodes_per_s\": %.1f, \"exit_code\": %d",
+            run->wall, run->scan, run->parse, run->user, run->sys, (long long)run->peak_rss_kb,
+            episodes > 0 ? (run->peak_rss_kb - baseline_rss_kb) * 1024.0 / episodes : 0,
+            run->wall > 0 ? episodes / run->wall : 0, run->exit_code);
+}
+
+// һģϰַʽУд뱨
+static int run_scale(const BenchConfig* config, const char* args, int episodes, int64_t baseline_rss_kb, FILE* out) {
+    char modeArgs[1024];
+    BenchRun* runs = (BenchRun*)calloc(config->runs, sizeof(BenchRun));
+    if (runs == NULL) {
+        return -1;
+    }
+    int nb_written = 0;
+    fprintf(out, "    {\"episodes\": %d, \"modes\": {", episodes);
+    for (int m = 0; m < (int)FF_ARRAY_ELEMS(scale_modes); m++) {
+        const ScaleMode* mode = &scale_modes[m];
+        const char* dropped = NULL;
+        snprintf(modeArgs, sizeof(modeArgs), "%s %s", args, mode->args);
+        clean_output(config);
+        if (mode->prime && run_bv2video(config, modeArgs, &runs[0], NULL) < 0) {
+            free(runs);
+            return -1;
+        }
+        for (int i = 0; i < config->runs; i++) {
+            if (mode->cold && (dropped = drop_page_cache(config->dir)) == NULL) {
+                break;
+            }
+            if (run_bv2video(config, modeArgs, &runs[i], NULL) < 0) {
+                free(runs);
+                return -1;
+            }
+            printf("%d 缯%s: %.3f 루ɨ %.3f 룬 %.3f 룩ֵڴ %lld KB\n", episodes, mode->name,
+                   runs[i].wall, runs[i].scan, runs[i].parse, (long long)runs[i].peak_rss_kb);
+        }
+        if (mode->cold && dropped == NULL) {
+            printf("֧ҳ棬仺\n");
+            continue;
+        }
+        qsort(runs, config->runs, sizeof(BenchRun), compare_wall);
+        fprintf(out, "%s\n      \"%s\": ", nb_written++ ? "," : "", mode->name);
+        write_scale_run_json(out, &runs[config->runs / 2], episodes, baseline_rss_kb);
+        if (mode->cold) {
+            fprintf(out, ", \"drop_method\": \"%s\"", dropped);
+        }
+        SyscallStats stats;
+        if (mode->count_syscalls && run_bv2video(config, modeArgs, &runs[0], &stats) == 0 && stats.total >= 0) {
+            fprintf(out, ", \"syscalls\": ");
+            write_syscalls_json(out, &stats);
+            printf("%d 缯%s: %lld ϵͳ\n", episodes, mode->name, (long long)stats.total);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n    }}");
+    clean_output(config);
+    free(runs);
+    return 0;
+}
+
+// ģԣֻԪݵĲĿ¼m4sΪļ-dryrunֻɨ衢ͷļ
+// ֱ䡢ҳʹɨ軺ʱʱֵڴϵͳô
+static int run_scale_bench(const BenchConfig* config, const int* sizes, int nb_sizes) {
+    char dir[1024], args[1024];
+    BenchRun baseline;
+    snprintf(args, sizeof(args), "-dryrun -nomanifest %s", config->args);
+
+    // Ŀ¼ϵķֵڴΪ׼Ӹģķֵڴмȥõÿ缯ռõڴ
+    BenchConfig scale = *config;
+    scale.dir = dir;
+    scale.episodes = 0;
+    scale.meta_only = 1;
+    snprintf(dir, sizeof(dir), "%s/scale_0/bilibili_video", config->dir);
+    make_dirs(dir);
+    snprintf(dir, sizeof(dir), "%s/scale_0", config->dir);
+    clean_output(&scale);
+    if (run_bv2video(&scale, args, &baseline, NULL) < 0) {
+        return -1;
+    }
+
+    FILE* out = config->report ? fopen(config->report, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "޷д %s\n", config->report);
+        return -1;
+    }
+    fprintf(out, "{\n  \"benchmark\": \"scale\",\n  \"args\": ");
+    json_print_string(out, args);
+    fprintf(out, ",\n  \"runs_per_mode\": %d,\n  \"baseline_rss_kb\": %lld,\n  \"scales\": [\n",
+            config->runs, (long long)baseline.peak_rss_kb);
+    int ret = 0;
+    for (int i = 0; i < nb_sizes && ret == 0; i++) {
+        int64_t bytes;
+        snprintf(dir, sizeof(dir), "%s/scale_%d", config->dir, sizes[i]);
+        scale.episodes = sizes[i];
+        if (config->regen || tree_input_bytes(&scale) < 0) {
+            if (generate_tree(&scale, &bytes) < 0) {
+                ret = -1;
+                break;
+            }
+            // bv2video޸ʱɨ迪ʼ2ĻɵĿ¼Ҫһܲɨ軺Ч
+#ifdef _WIN32
+            Sleep(3000);
+#else
+            sleep(3);
+#endif
+        }
+        if (i > 0) {
+            fprintf(out, ",\n");
+        }
+        ret = run_scale(&scale, args, sizes[i], baseline.peak_rss_kb, out);
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    return ret;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "÷: %s [ѡ]\n"
+            "  -bin ·          bv2videoִļĬΪ./bv2video\n"
+            "  -dir Ŀ¼          Ŀ¼ĬΪbench_tree\n"
+            "  -args \"\"       bv2videoĲ\n"
+            "  -episodes N        缯ĬΪ20\n"
+            "  -variants N        ͬݵľ缯缯ЩݣĬÿ缯\n"
+            "  -duration        ÿ缯ʱĬΪ60\n"
+            "  -size x        ƵֱʣĬΪ1280x720\n"
+            "  -fps N             ֡ʣĬΪ30\n"
+            "  -vbitrate      ƵʣĬΪ2M\n"
+            "  -abitrate      ƵʣĬΪ128k\n"
+            "  -runs N            дĬΪ3\n"
+            "  -regen             ɲ\n"
+            "  -genonly           ֻɲ\n"
+            "  -scale N,N,...     ģԣڸ缯ֻԪݵĿ¼ϲɨͽ\n"
+            "  -o ļ            JSONдļĬ׼\n",
+            name);
+}
+
+int main(int argc, char** argv) {
+    setlocale(LC_ALL, "zh_CN.UTF-8");
+#ifdef _WIN32
+    SetConsoleOutputCP(CP_UTF8);
+#endif
+
+    BenchConfig config = { 0 };
+#ifdef _WIN32
+    config.bin = "bv2video.exe";
+#else
+    config.bin = "./bv2video";
+#endif
+    config.dir = "bench_tree";
+    config.args = "";
+    config.episodes = 20;
+    config.duration = 60;
+    config.width = 1280;
+    config.height = 720;
+    config.fps = 30;
+    config.video_bitrate = 2000000;
+    config.audio_bitrate = 128000;
+    config.runs = 3;
+    int sizes[16], nb_sizes = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* next = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "-bin") == 0 && next) {
+            config.bin = argv[++i];
+        }
+        else if (strcmp(argv[i], "-dir") == 0 && next) {
+            config.dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "-args") == 0 && next) {
+            config.args = argv[++i];
+        }
+        else if (strcmp(argv[i], "-episodes") == 0 && next) {
+            config.episodes = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-variants") == 0 && next) {
+            config.variants = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-duration") == 0 && next) {
+            config.duration = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-size") == 0 && next && sscanf(next, "%dx%d", &config.width, &config.height) == 2) {
+            i++;
+        }
+        else if (strcmp(argv[i], "-fps") == 0 && next) {
+            config.fps = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-vbitrate") == 0 && next) {
+            config.video_bitrate = parse_bitrate(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-abitrate") == 0 && next) {
+            config.audio_bitrate = parse_bitrate(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-runs") == 0 && next) {
+            config.runs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-regen") == 0) {
+            config.regen = 1;
+        }
+        else if (strcmp(argv[i], "-genonly") == 0) {
+            config.gen_only = 1;
+        }
+        else if (strcmp(argv[i], "-scale") == 0 && next) {
+            for (const char* p = argv[++i]; *p && nb_sizes < (int)FF_ARRAY_ELEMS(sizes); p += strcspn(p, ",")) {
+                p += *p == ',';
+                if ((sizes[nb_sizes] = atoi(p)) > 0) {
+                    nb_sizes++;
+                }
+            }
+        }
+        else if (strcmp(argv[i], "-o") == 0 && next) {
+            config.report = argv[++i];
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.episodes <= 0 || config.runs <= 0 || config.duration <= 0 || config.fps <= 0 ||
+        config.width <= 0 || config.height <= 0 || (config.width | config.height) & 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (nb_sizes > 0) {
+        return run_scale_bench(&config, sizes, nb_sizes) < 0;
+    }
+
+    int64_t input_bytes = config.regen ? -1 : tree_input_bytes(&config);
+    if (input_bytes < 0 && generate_tree(&config, &input_bytes) < 0) {
+        return 1;
+    }
+    printf(": %d 缯 %.1f MB\n", config.episodes, input_bytes / 1e6);
+    if (config.gen_only) {
+        return 0;
+    }
+
+    BenchRun* runs = (BenchRun*)calloc(config.runs, sizeof(BenchRun));
+    if (runs == NULL) {
+        return 1;
+    }
+    for (int i = 0; i < config.runs; i++) {
+        if (run_once(&config, &runs[i]) < 0) {
+            free(runs);
+            return 1;
+        }
+        printf("%d: %.3f 룬%.2f 缯/룬%.1f MB/s˳ %d\n", i + 1, runs[i].wall,
+               config.episodes / runs[i].wall, input_bytes / 1e6 / runs[i].wall, runs[i].exit_code);
+    }
+
+    FILE* out = config.report ? fopen(config.report, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "޷д %s\n", config.report);
+        free(runs);
+        return 1;
+    }
+    write_report(out, &config, input_bytes, runs);
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(runs);
+    return 0;
+}